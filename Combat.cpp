@@ -1,129 +1,46 @@
 
+// Build with COMBAT_HEADLESS defined to get a console-only executable that runs
+// CombatSim matches on every core (see CombatFarm.h) without creating a window
+// or GL context, e.g.
+//     g++ -std=c++17 -O2 -ffp-contract=off -DCOMBAT_HEADLESS Combat.cpp -o combat_headless -lpthread
+// Pass --deterministic to run the fixed-point physics mode; its final state hash
+// should match across compilers, flags and targets (native vs pge2wasm), as
+// long as multiply-adds aren't contracted (see CombatRules::bDeterministic).
+#if defined(COMBAT_HEADLESS)
+#define OLC_PLATFORM_CUSTOM_EX
+#else
 #define OLC_PGE_APPLICATION
 #define OLC_PGEX_SOUND
+// Time the engine's frame stages on this thread's profiler; F3 shows it. The
+// stages and the audio thread's work also go to the Chrome trace, F5 saves it
+#include "CombatProfiler.h"
+#define OLC_PROFILE_BEGIN(stage) if (FrameProfiler::pActive) FrameProfiler::pActive->Begin(FrameProfiler::STAGE_##stage)
+#define OLC_PROFILE_END(stage) if (FrameProfiler::pActive) FrameProfiler::pActive->End(FrameProfiler::STAGE_##stage)
+#define OLC_SOUND_TRACE_BEGIN(name) TraceRecorder::Begin(name)
+#define OLC_SOUND_TRACE_END(name) TraceRecorder::End(name)
+#define OLC_SOUND_TRACE_INSTANT(name) TraceRecorder::Instant(name)
+#endif
 #include "olcPixelGameEngine.h"
 // #include "olcPGEX_Sound.h"
 #include "math.h"
 #define PI 3.14159265
 #include <algorithm>
 #include <functional>
+#include <random>
 #undef min
 #undef max
+#include "CombatSim.h"
+#include "CombatReplay.h"
+#include "CombatArenas.h"
+#include "CombatMap.h"
+#if defined(COMBAT_HEADLESS)
+#include "CombatFarm.h"
+#include "CombatRollback.h"
+#include "CombatBench.h"
+#include "CombatGen.h"
+#include <deque>
+#endif
 
-namespace olc
-{
-    namespace aabb
-    {
-        struct rect
-        {
-            olc::vf2d pos;
-            olc::vf2d size;
-            olc::vf2d vel;
-
-            std::array<olc::aabb::rect*, 4> contact;
-        };
-
-        bool PointVsRect(const olc::vf2d& p, const olc::aabb::rect* r)
-        {
-            return (p.x >= r->pos.x && p.y >= r->pos.y && p.x < r->pos.x + r->size.x && p.y < r->pos.y + r->size.y);
-        }
-
-        bool RectVsRect(const olc::aabb::rect* r1, const olc::aabb::rect* r2)
-        {
-            return (r1->pos.x < r2->pos.x + r2->size.x && r1->pos.x + r1->size.x > r2->pos.x && r1->pos.y < r2->pos.y + r2->size.y && r1->pos.y + r1->size.y > r2->pos.y);
-        }
-
-        bool RayVsRect(const olc::vf2d& ray_origin, const olc::vf2d& ray_dir, const rect* target, olc::vf2d& contact_point, olc::vf2d& contact_normal, float& t_hit_near)
-        {
-            contact_normal = { 0,0 };
-            contact_point = { 0,0 };
-
-            // Cache division
-            olc::vf2d invdir = 1.0f / ray_dir;
-
-            // Calculate intersections with rectangle bounding axes
-            olc::vf2d t_near = (target->pos - ray_origin) * invdir;
-            olc::vf2d t_far = (target->pos + target->size - ray_origin) * invdir;
-
-            if (std::isnan(t_far.y) || std::isnan(t_far.x)) return false;
-            if (std::isnan(t_near.y) || std::isnan(t_near.x)) return false;
-
-            // Sort distances
-            if (t_near.x > t_far.x) std::swap(t_near.x, t_far.x);
-            if (t_near.y > t_far.y) std::swap(t_near.y, t_far.y);
-
-            // Early rejection		
-            if (t_near.x > t_far.y || t_near.y > t_far.x) return false;
-
-            // Closest 'time' will be the first contact
-            t_hit_near = std::max(t_near.x, t_near.y);
-
-            // Furthest 'time' is contact on opposite side of target
-            float t_hit_far = std::min(t_far.x, t_far.y);
-
-            // Reject if ray direction is pointing away from object
-            if (t_hit_far < 0)
-                return false;
-
-            // Contact point of collision from parametric line equation
-            contact_point = ray_origin + t_hit_near * ray_dir;
-
-            if (t_near.x > t_near.y)
-                if (invdir.x < 0)
-                    contact_normal = { 1, 0 };
-                else
-                    contact_normal = { -1, 0 };
-            else if (t_near.x < t_near.y)
-                if (invdir.y < 0)
-                    contact_normal = { 0, 1 };
-                else
-                    contact_normal = { 0, -1 };
-
-            // Note if t_near == t_far, collision is principly in a diagonal
-            // so pointless to resolve. By returning a CN={0,0} even though its
-            // considered a hit, the resolver wont change anything.
-            return true;
-        }
-
-        bool DynamicRectVsRect(const olc::aabb::rect* r_dynamic, const float fTimeStep, const olc::aabb::rect& r_static,
-            olc::vf2d& contact_point, olc::vf2d& contact_normal, float& contact_time)
-        {
-            // Check if dynamic rectangle is actually moving - we assume rectangles are NOT in collision to start
-            if (r_dynamic->vel.x == 0 && r_dynamic->vel.y == 0)
-                return false;
-
-            // Expand target rectangle by source dimensions
-            olc::aabb::rect expanded_target;
-            expanded_target.pos = r_static.pos - r_dynamic->size / 2;
-            expanded_target.size = r_static.size + r_dynamic->size;
-
-            if (RayVsRect(r_dynamic->pos + r_dynamic->size / 2, r_dynamic->vel * fTimeStep, &expanded_target, contact_point, contact_normal, contact_time))
-                return (contact_time >= 0.0f && contact_time < 1.0f);
-            else
-                return false;
-        }
-
-
-
-        bool ResolveDynamicRectVsRect(olc::aabb::rect* r_dynamic, const float fTimeStep, olc::aabb::rect* r_static)
-        {
-            olc::vf2d contact_point, contact_normal;
-            float contact_time = 0.0f;
-            if (DynamicRectVsRect(r_dynamic, fTimeStep, *r_static, contact_point, contact_normal, contact_time))
-            {
-                if (contact_normal.y > 0) r_dynamic->contact[0] = r_static; else nullptr;
-                if (contact_normal.x < 0) r_dynamic->contact[1] = r_static; else nullptr;
-                if (contact_normal.y < 0) r_dynamic->contact[2] = r_static; else nullptr;
-                if (contact_normal.x > 0) r_dynamic->contact[3] = r_static; else nullptr;
-
-                r_dynamic->vel += contact_normal * olc::vf2d(std::abs(r_dynamic->vel.x), std::abs(r_dynamic->vel.y)) * (1 - contact_time);
-                return true;
-            }
-
-            return false;
-        }
-    }
-}
 /*
  * Generic function to find if an element of any type exists in list
  */
@@ -137,95 +54,109 @@ bool contains(std::list<T>& listOfElements, const T& element)
     return it != listOfElements.end();
 }
 
+// Stand-in for the player: holds a random set of direction keys for a random
+// number of ticks and taps fire now and then.
+struct RandomBot
+{
+    std::mt19937 rng;
+    CombatInput held;
+    int nHoldTicks = 0;
+
+    explicit RandomBot(uint32_t seed) : rng(seed) {}
+
+    CombatInput Next()
+    {
+        if (--nHoldTicks <= 0) {
+            uint32_t b = rng();
+            held.bUp = b & 1; held.bDown = (b & 2) && !held.bUp;
+            held.bLeft = b & 4; held.bRight = (b & 8) && !held.bLeft;
+            nHoldTicks = 10 + int(rng() % 50);
+        }
+        CombatInput in = held;
+        in.bFire = (rng() % 40) == 0;
+        return in;
+    }
+};
+
+
+// Board nIndex of a map file, or the original board without one; null, once
+// the reason has been printed, if it can't be loaded
+std::shared_ptr<const CombatBoard> LoadBoard(const std::string& sMapFile, int nIndex)
+{
+    if (sMapFile.empty())
+        return CombatBoard::Default();
+    CombatMapFile maps;
+    if (!maps.Open(sMapFile)) {
+        std::cerr << "Couldn't load map " << sMapFile << ": " << maps.sError << "\n";
+        return nullptr;
+    }
+    if (nIndex < 0 || nIndex >= maps.Count()) {
+        std::cerr << sMapFile << " has boards 0-" << maps.Count() - 1 << "\n";
+        return nullptr;
+    }
+    auto board = maps.Board(nIndex);
+    if (!board)
+        std::cerr << "Couldn't load board " << nIndex << " of " << sMapFile << ": " << maps.sError << "\n";
+    return board;
+}
+
+std::string BoardSummary(const CombatBoard& board)
+{
+    if (board.bStreamed)
+        return std::to_string(board.nBoardWidth) + "x" + std::to_string(board.nBoardHeight) + " tiles, streamed in "
+            + std::to_string(board.nChunksX) + "x" + std::to_string(board.nChunksY) + " chunks";
+    return std::to_string(board.nBoardTiles) + " tiles merged into " + std::to_string(board.vRects.size()) + " wall rects";
+}
 
+#if !defined(COMBAT_HEADLESS)
 class Combat : public olc::PixelGameEngine
 {
-    std::wstring sBoard;
-   
-
-    class Tank {
-
-    public:
-
-        Tank() {
-            ang = 0;
-            bullet_exists = true;
-            spinning = false;
-            bullet.pos = { 0,0 };
-            score = 0;
-            tankRect = { {0,0},{8,8},{0,0} };
-        }       
-        float ang;
-        bool bullet_exists;
-        bool spinning;
-        int score;
-        olc::aabb::rect bullet, tankRect;
-
-   };
-       
-
-    Tank myTank, otherTank;
-    int nBoardWidth;
-    int nBoardHeight;
-    int nSquareSize;
-    bool collision = false;
-    bool blocked = false;
-    bool spinning = false;
-    std::vector<olc::aabb::rect> vRects, vprevtankRects;
-    float fAccumTime = 0;
+    CombatSim sim;
+    CombatInput input;
+    float fTickAccum = 0;
     olc::Sprite* sprTank = nullptr, *sprBG = nullptr, *sprBullet = nullptr, *sprFont = nullptr;
+    olc::Pixel pFloor, pWall;   // combat.png's, for boards other than the one it shows
     olc::Decal* decTank = nullptr, * decBG = nullptr, * decBullet = nullptr, *decFont = nullptr;
     int sndIdle = 0, sndDriving = 0, sndPew = 0, sndPow = 0;
-    int r = 0,q = 8;
     int Tanksize = 8;
-    olc::vf2d muzzle_pos[16] = { {7,3} ,{ 7,5 }, { 7,7 }, { 5,7 },{ 3,7 }, {2,7} ,{ 0,7 }, { 0,5 }, { 0,3 }, { 0,2 }, { 0,0 }, { 2,0 }, { 3,0 }, { 5,0 }, { 7,0 }, { 7,2 }, };
+    FrameProfiler profiler;
+    bool bShowProfiler = false;
+    CombatReplay replay;        // Being recorded, or played back when bPlayback is set
+    bool bPlayback = false;
+    CombatArenas arenas;        // Attract mode, when nArenas is set
+    std::vector<RandomBot> vBots;
+    std::vector<WallStream> vViews;     // Per arena, or just the game's: the chunks on screen of a streamed board
+
+public:
+    CombatRules rules;          // For a new match; a replay brings its own
+    std::shared_ptr<const CombatBoard> board = CombatBoard::Default();
+    int nArenas = 0;            // Bot matches to tile over the window instead of a game
+
+    // Plays the replay back in real time instead of reading the keyboard
+    bool LoadReplay(const std::string& sFile)
+    {
+        bPlayback = replay.Load(sFile);
+        return bPlayback;
+    }
+
+    // The part of a board one screen shows: all of it, up to the original
+    // board's 188x136; the camera scrolls around the player on anything bigger
+    static olc::vf2d ViewSize(const CombatBoard& b)
+    {
+        return b.PixelSize().min({ 188, 136 });
+    }
+
+private:
     
 
     virtual bool OnUserCreate()
     {
-        nBoardWidth = 47;
-        nBoardHeight = 34;
-        nSquareSize = 4;
-
-        sBoard += L"...............................................";
-        sBoard += L"...............................................";
-        sBoard += L"...............................................";
-        sBoard += L"###############################################";
-        sBoard += L"#.....................###.....................#";
-        sBoard += L"#.....................###.....................#";
-        sBoard += L"#.....................###.....................#";
-        sBoard += L"#.............................................#";
-        sBoard += L"#......####.........................####......#";
-        sBoard += L"#.............................................#";
-        sBoard += L"#.............................................#";
-        sBoard += L"#...............####.......####...............#";
-        sBoard += L"#...............##...........##...............#";
-        sBoard += L"#.....##...............................##.....#";
-        sBoard += L"#......#...............................#......#";
-        sBoard += L"#......#...............................#......#";
-        sBoard += L"#......#...............................#......#";
-        sBoard += L"#......#....##...................##....#......#";
-        sBoard += L"#......#....##...................##....#......#";
-        sBoard += L"#......#....##...................##....#......#";
-        sBoard += L"#......#...............................#......#";
-        sBoard += L"#......#...............................#......#";
-        sBoard += L"#.....##...............................##.....#";
-        sBoard += L"#.............................................#";
-        sBoard += L"#...............##...........##...............#";
-        sBoard += L"#...............####.......####...............#";
-        sBoard += L"#.............................................#";
-        sBoard += L"#.............................................#";
-        sBoard += L"#......####.........................####......#";
-        sBoard += L"#.............................................#";
-        sBoard += L"#.....................###.....................#";
-        sBoard += L"#.....................###.....................#";
-        sBoard += L"#.....................###.....................#";
-        sBoard += L"###############################################";
-
         sprTank = new olc::Sprite("./assets/tank.png");
         decTank = new olc::Decal(sprTank);
         sprBG = new olc::Sprite("./assets/combat.png");
         decBG = new olc::Decal(sprBG);
+        pFloor = sprBG->GetPixel(8, 20);
+        pWall = sprBG->GetPixel(1, 13);
         sprBullet = new olc::Sprite("./assets/1pixel.png");
         decBullet = new olc::Decal(sprBullet);
         sprFont = new olc::Sprite("./assets/combat_font.png");
@@ -239,22 +170,33 @@ class Combat : public olc::PixelGameEngine
         sndPow = olc::SOUND::LoadAudioSample("pow.wav");
         */
 
-        //Initial positiions
-        myTank.tankRect.pos = { 70,68 };
-        otherTank.tankRect.pos = { 168,68 };
-        otherTank.ang = PI;
-        
-       //Put all Board tiles in vRects
-       for (int y = 0; y < nBoardHeight; y++) {
-           for (int x = 0; x < (nBoardWidth); x++) {
-                if (sBoard[(y * nBoardWidth) + x] == '#') {
-                    vRects.push_back({ {float (x * nSquareSize),float( y * nSquareSize)}, {float (nSquareSize), float (nSquareSize)} });
-                }
-               
+        vViews.resize(std::max(nArenas, 1));
+        for (WallStream& view : vViews)
+            view.Reset(board->bStreamed ? board.get() : nullptr);
+        if (nArenas > 0) {
+            for (int i = 0; i < nArenas; i++) {
+                arenas.Add(board, rules);
+                vBots.emplace_back(uint32_t(i + 1));
             }
-
+            arenas.Start(int(std::max(1u, std::thread::hardware_concurrency())), [this](int i, const CombatSim&, CombatInput& in, CombatInput&) {
+                in = vBots[i].Next();
+            });
         }
-        
+        if (bPlayback) {
+            if (replay.nBoardHash != board->nHash) {
+                std::cout << "Replay was recorded on a different board\n";
+                return false;
+            }
+            sim.Create(board, replay.rules);
+        }
+        else {
+            sim.Create(board, rules);
+            replay.Begin(sim);
+        }
+        std::cout << "Board: " << BoardSummary(*board) << "\n";
+        FrameProfiler::pActive = &profiler;
+        TraceRecorder::Enable(true);
+        TraceRecorder::NameThread("engine");
 
         return true;
     }
@@ -263,234 +205,843 @@ class Combat : public olc::PixelGameEngine
     
     virtual bool OnUserUpdate(float fElapsedTime)
     {
-        DrawDecal({0, 0}, decBG); //Draw background from GPU
-
-        DrawPartialDecal({ 40,3 }, decFont, { float((myTank.score % 10) * 12), 0 }, { 12,5 }, { 1,1 }, olc::RED);
-        if (myTank.score > 9)
-            DrawPartialDecal({ 27,3 }, decFont, { float((myTank.score / 10) * 12), 0 }, { 12,5 }, { 1,1 }, olc::RED);
-
-        DrawPartialDecal({132 ,3 }, decFont, { float((otherTank.score % 10) * 12), 0 }, { 12,5 }, { 1,1 }, olc::BLUE);
-        if (otherTank.score > 9)
-            DrawPartialDecal({ 119,3 }, decFont, { float((otherTank.score / 10) * 12), 0 }, { 12,5 }, { 1,1 }, olc::BLUE);
-
-
-        if (myTank.spinning) {            
-            myTank.ang -= 0.125 * PI;
-            if (abs(myTank.ang) >= 2 * PI)
-                myTank.ang = 0;
+        TraceRecorder::Scope trace("OnUserUpdate");
+
+        // Held keys are sampled every frame, fire is latched until a tick consumes it
+        profiler.Begin(FrameProfiler::STAGE_INPUT);
+        input.bUp = GetKey(olc::UP).bHeld;
+        input.bDown = GetKey(olc::DOWN).bHeld;
+        input.bLeft = GetKey(olc::LEFT).bHeld;
+        input.bRight = GetKey(olc::RIGHT).bHeld;
+        if (GetKey(olc::SPACE).bPressed)
+            input.bFire = true;
+        if (GetKey(olc::F3).bPressed)
+            bShowProfiler = !bShowProfiler;
+        if (GetKey(olc::F4).bPressed)
+            std::cout << (profiler.SaveCSV("combat_profile.csv") ? "Saved" : "Couldn't save") << " combat_profile.csv\n";
+        if (GetKey(olc::F5).bPressed)
+            std::cout << (TraceRecorder::Flush("combat_trace.json") ? "Saved" : "Couldn't save") << " combat_trace.json\n";
+        if (GetKey(olc::F6).bPressed && !bPlayback && nArenas == 0)
+            SaveReplay();
+        profiler.End(FrameProfiler::STAGE_INPUT);
+
+        // Run as many fixed ticks as the frame covers, but don't try to catch up after a long stall
+        fTickAccum = std::min(fTickAccum + fElapsedTime, 0.25f);
+        if (nArenas > 0) {
+            int nTicks = int(fTickAccum / CombatSim::fTickTime);
+            fTickAccum -= nTicks * CombatSim::fTickTime;
+            arenas.Step(nTicks);
+            DrawArenas();
+            if (bShowProfiler)
+                DrawProfiler();
+            return true;
         }
-        else {
-            // Find first occurence of sample id
-          /*  auto s = std::find_if(olc::SOUND::listActiveSamples.begin(), olc::SOUND::listActiveSamples.end(), [&](const olc::SOUND::sCurrentlyPlayingSample& s) { return s.nAudioSampleID == sndIdle; });
-            if (s == olc::SOUND::listActiveSamples.end())
-                olc::SOUND::PlaySample(sndIdle, true);
-                */
-            if ((GetKey(olc::UP).bHeld) || (GetKey(olc::DOWN).bHeld)) {
-                
-                myTank.tankRect.vel = { 6*cosf(r*.125*PI),6*(sinf(r*.125*PI)) };
+        while (fTickAccum >= CombatSim::fTickTime) {
+            TraceRecorder::Scope traceTick("tick");
+            if (bPlayback) {
+                if (sim.nTick < replay.Ticks()) {
+                    sim.Tick(replay.Input(sim.nTick), replay.Input2(sim.nTick));
+                    if (sim.nTick == replay.Ticks() && replay.nFinalHash != 0)
+                        std::cout << "Replay finished, state " << (sim.StateHash() == replay.nFinalHash ? "matches" : "differs from") << " the recording\n";
+                }
             }
             else {
-                myTank.tankRect.vel = { 0,0 };
-             //   olc::SOUND::StopSample(sndDriving);
+                sim.Tick(input);
+                replay.Record(input);
             }
+            input.bFire = false;
+            fTickAccum -= CombatSim::fTickTime;
+        }
 
-            if (GetKey(olc::DOWN).bHeld) {
-                myTank.tankRect.vel = {-myTank.tankRect.vel.x, -myTank.tankRect.vel.y};
-            }
+        FrameProfiler::Scope scope(FrameProfiler::STAGE_DECALS);
+        DrawArena(sim, { 0, 0 }, 1, vViews[0]);
 
-            if (GetKey(olc::LEFT).bHeld) {
-                myTank.ang += 0.125 * PI * fElapsedTime * 6;
-            }
-            if (GetKey(olc::RIGHT).bHeld) {
-                myTank.ang -= 0.125 * PI * fElapsedTime * 6;
+        if (bShowProfiler)
+            DrawProfiler();
+
+        return true;
+    }
+
+    // One match's board, scores, tanks and bullets, scaled by fScale with the
+    // top left corner of the view at vOrigin. On a board bigger than
+    // ViewSize() the view follows tank 0 and only what's on screen is drawn;
+    // a streamed board also only has the chunks on screen merged, into view.
+    void DrawArena(const CombatSim& sim, const olc::vf2d& vOrigin, float fScale, WallStream& view)
+    {
+        const CombatSim::TankTable& tanks = sim.tanks;
+        const olc::Pixel aTeamColour[2] = { olc::RED, olc::BLUE };
+        const olc::vf2d vScale = { fScale, fScale };
+        olc::vf2d vView = ViewSize(*sim.board);
+        olc::vf2d vCamera = (tanks.aPos[0] + CombatSim::vTankSize / 2 - vView / 2).max({ 0, 0 }).min(sim.board->PixelSize() - vView).floor();
+        auto at = [&](const olc::vf2d& p) { return vOrigin + (p - vCamera) * fScale; };
+        auto onScreen = [&](const olc::vf2d& p, const olc::vf2d& size) { return p.x < vCamera.x + vView.x && p.y < vCamera.y + vView.y && p.x + size.x > vCamera.x && p.y + size.y > vCamera.y; };
+
+        //Draw background from GPU; other boards get their walls drawn in its colours
+        if (sim.board->nHash == CombatBoard::Default()->nHash)
+            DrawDecal(vOrigin, decBG, vScale);
+        else {
+            // Walls cut to the view, so they stay inside an arena's cell
+            FillRectDecal(vOrigin, vView * fScale, pFloor);
+            if (sim.board->bStreamed) {
+                view.Want(vCamera, vCamera + vView);
+                view.Commit();
             }
-            if (abs(myTank.ang) >= 2 * PI)
-                myTank.ang = 0;
-
-            //Driving sound
-        /*    if (myTank.tankRect.vel.x != 0 || myTank.tankRect.vel.y != 0) {
-                auto s = std::find_if(olc::SOUND::listActiveSamples.begin(), olc::SOUND::listActiveSamples.end(), [&](const olc::SOUND::sCurrentlyPlayingSample& s) { return s.nAudioSampleID == sndDriving; });
-                if (s == olc::SOUND::listActiveSamples.end()) {
-                    olc::SOUND::StopSample(sndIdle);
-                    olc::SOUND::PlaySample(sndDriving);
+            for (const olc::aabb::rect& wall : sim.board->bStreamed ? view.vRects : sim.board->vRects)
+                if (onScreen(wall.pos, wall.size)) {
+                    olc::vf2d tl = wall.pos.max(vCamera), br = (wall.pos + wall.size).min(vCamera + vView);
+                    FillRectDecal(at(tl), (br - tl) * fScale, pWall);
                 }
-                
-            }*/
         }
 
-        r = (int((myTank.ang / PI) * 8)); r = (r < 0) ? abs(r) : 16 - r; if (r == 16) r = 0;  //Set rotation to one of 16 positions
-        
-       
+        //Team scores, which with two tanks are just theirs. They stay put when the view scrolls.
+        int nRedScore = sim.TeamTotal(tanks.aScore, 0) % 100, nBlueScore = sim.TeamTotal(tanks.aScore, 1) % 100;
+        auto hud = [&](const olc::vf2d& p) { return vOrigin + p * fScale; };
+        DrawPartialDecal(hud({ 40,3 }), decFont, { float((nRedScore % 10) * 12), 0 }, { 12,5 }, vScale, olc::RED);
+        if (nRedScore > 9)
+            DrawPartialDecal(hud({ 27,3 }), decFont, { float((nRedScore / 10) * 12), 0 }, { 12,5 }, vScale, olc::RED);
 
-        if (otherTank.spinning) {
-            otherTank.ang += 0.125 * PI;
-            if (abs(otherTank.ang) >= 2 * PI)
-                otherTank.ang = 0;
-        }
-        else {
-           
-            if (blocked) {
-                otherTank.ang -= (0.125 * PI); 
-                blocked = false;
-            }
-            if (abs(otherTank.ang) >= 2 * PI)
-                otherTank.ang = 0;
-            q = (int((otherTank.ang / PI) * 8)); q = (q < 0) ? abs(q) : 16 - q; if (q == 16) q = 0;
-            otherTank.tankRect.vel = { float(3.0 * cosf(q * 0.125 * PI)),float(3.0 * (sinf(q * 0.125 * PI))) };
-            }
-        q = (int((otherTank.ang / PI) * 8)); q = (q < 0) ? abs(q) : 16 - q; if (q == 16) q = 0; //Set rotational position
-       
-       
-        //Fire bullet on spacebar
-        if ((GetKey(olc::SPACE).bPressed) && myTank.spinning == false && otherTank.spinning == false) {
-            myTank.bullet_exists = true;
-            myTank.bullet.pos = muzzle_pos[r]+myTank.tankRect.pos;
-            myTank.bullet.size = { 1.0,1.0 };
-            myTank.bullet.vel = { float(100.0 * cosf(r*0.125*PI)),float (100.0 * (sinf(r*0.125*PI))) };          
-          //  olc::SOUND::PlaySample(sndPew);
+        DrawPartialDecal(hud({132 ,3 }), decFont, { float((nBlueScore % 10) * 12), 0 }, { 12,5 }, vScale, olc::BLUE);
+        if (nBlueScore > 9)
+            DrawPartialDecal(hud({ 119,3 }), decFont, { float((nBlueScore / 10) * 12), 0 }, { 12,5 }, vScale, olc::BLUE);
+
+        //Draw Tanks
+        for (int i = 0; i < tanks.nCount; i++) {
+            if (!onScreen(tanks.aPos[i], CombatSim::vTankSize))
+                continue;
+            int h = tanks.aHeading[i];
+            DrawPartialDecal(at(tanks.aPos[i]), decTank, { float((h % 4) * Tanksize),float((h / 4) * Tanksize) }, { float(Tanksize),float(Tanksize) }, vScale, aTeamColour[CombatSim::Team(i)]);
         }
 
-        fAccumTime += fElapsedTime;
-        if (fAccumTime > 1) {
-            if (myTank.spinning || otherTank.spinning) {   //Resume after spin
-                otherTank.bullet_exists = true;
-                myTank.spinning = false; otherTank.spinning = false;
+        //Draw bullets in flight
+        for (int i = 0; i < tanks.nCount; i++) {
+            if (!sim.HasFlag(i, CombatSim::TANK_ARMED))
+                continue;
+            for (int n = 0; n < sim.bullets.Count(i); n++) {
+                const olc::vf2d& p = sim.bullets.aPos[sim.bullets.Slot(i, n)];
+                if (onScreen(p, CombatSim::vBulletSize))
+                    DrawDecal(at(p), decBullet, vScale);
             }
-            
         }
+    }
+
+    // Every arena in a grid as near square as it goes, each shrunk to fit its cell
+    void DrawArenas()
+    {
+        FrameProfiler::Scope scope(FrameProfiler::STAGE_DECALS);
+        int nCols = int(std::ceil(std::sqrt(float(arenas.Count()))));
+        int nRows = (arenas.Count() + nCols - 1) / nCols;
+        olc::vf2d vBoard = ViewSize(*board);
+        float fScale = std::min(ScreenWidth() / (nCols * vBoard.x), ScreenHeight() / (nRows * vBoard.y));
+        for (int i = 0; i < arenas.Count(); i++)
+            DrawArena(arenas.Get(i).sim, olc::vf2d{ float(i % nCols), float(i / nCols) } * vBoard * fScale, fScale, vViews[i]);
+    }
+
+    void SaveReplay()
+    {
+        replay.Finish(sim);
+        std::cout << (replay.Save("combat_replay.cmr") ? "Saved" : "Couldn't save") << " combat_replay.cmr (" << replay.Ticks() << " ticks)\n";
+    }
 
-        if (fAccumTime >  5) {           
-            if (otherTank.bullet_exists) {  //Fire bullet every few seconds
-                otherTank.bullet.pos = muzzle_pos[q]+otherTank.tankRect.pos;
-                otherTank.bullet.size = { 1.0,1.0 };
-                otherTank.bullet.vel = { float(100.0 * cosf(q * 0.125 * PI)),float(100.0 * (sinf(q * 0.125 * PI))) };
-               // olc::SOUND::PlaySample(sndPew);
-            }  
-            fAccumTime = 0;
+    // Rolling min/avg/p99 of each frame stage, in milliseconds
+    void DrawProfiler()
+    {
+        const olc::vf2d vScale = { 0.5f, 0.5f };
+        FillRectDecal({ 2, 12 }, { 108, 4.5f * (FrameProfiler::STAGE_COUNT + 1) + 2 }, olc::Pixel(0, 0, 0, 192));
+        DrawStringDecal({ 4, 13 }, "stage     min   avg   p99", olc::YELLOW, vScale);
+        for (int s = 0; s < FrameProfiler::STAGE_COUNT; s++) {
+            FrameProfiler::Stats st = profiler.Get(FrameProfiler::Stage(s));
+            char sLine[64];
+            snprintf(sLine, sizeof(sLine), "%-8s%6.2f%6.2f%6.2f", FrameProfiler::StageName(s), st.fMin, st.fAvg, st.fP99);
+            DrawStringDecal({ 4, 13 + 4.5f * (s + 1) }, sLine, olc::WHITE, vScale);
         }
-        
-        //Draw Tanks
-        
-        DrawPartialDecal(myTank.tankRect.pos, decTank, { float((r % 4) * Tanksize),float((r / 4) * Tanksize) }, { float(Tanksize),float(Tanksize) }, { 1, 1 }, olc::RED);
-        DrawPartialDecal(otherTank.tankRect.pos, decTank, { float((q % 4) * Tanksize),float((q / 4) * Tanksize) }, { float(Tanksize),float(Tanksize) }, { 1, 1 }, olc::BLUE);
+    }
+     bool OnUserDestroy()
+            {
+                //olc::SOUND::DestroyAudio();
+                arenas.Stop();
+                TraceRecorder::Flush("combat_trace.json");
+                if (!bPlayback && nArenas == 0)
+                    SaveReplay();
+                return true;
+            }
+};
+#endif
+ 
 
-        //Precess motion for tanks and bullets
-        for (int k = 0; k < 2; k++) {
-            olc::Pixel p, curp;
-            Tank* curTank = nullptr;
-            Tank* curoppTank = nullptr;
 
-            if (k == 0) {   //Player's tank
-                curp = olc::Pixel(255, 0, 0);
-                curTank = &myTank;
-                curoppTank = &otherTank;
+#if defined(COMBAT_HEADLESS)
+// The engine implementation isn't compiled into headless builds, but the colour
+// constants declared in olcPixelGameEngine.h still need this constructor.
+olc::Pixel::Pixel(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha)
+{
+    n = red | (green << 8) | (blue << 16) | (alpha << 24);
+}
 
-            }
-            if (k == 1) { //AI tank
-                curp = olc::Pixel(0, 0, 255);
-                curTank = &otherTank;
-                curoppTank = &myTank;
-            }
+// Heap allocations made on this thread. The headless runner asserts that no
+// tick allocates once a match is set up.
+thread_local size_t nAllocations = 0;
 
-           
-            vRects.push_back(curoppTank->tankRect); //Add Opponent tank to vRects
-
-            olc::vf2d cp, cn;
-            float t = 0, min_t = INFINITY;
-            std::vector<std::pair<int, float>> z;
-
-            if ((*curTank).bullet_exists) {
-                if ((*curTank).bullet.vel.x != 0 || (*curTank).bullet.vel.y != 0) //While bullet in flight
-                    DrawDecal((*curTank).bullet.pos,decBullet) ;
-                // Work out collision point, add it to vector along with rect ID
-                for (size_t i = 0; i < vRects.size(); i++)
-                {
-                    if (olc::aabb::DynamicRectVsRect(&(*curTank).bullet, fElapsedTime, vRects[i], cp, cn, t))
-                    {
-                        z.push_back({ i, t });
-                    }
-                }
+void* operator new(size_t nSize)
+{
+    nAllocations++;
+    if (void* p = std::malloc(nSize ? nSize : 1))
+        return p;
+    throw std::bad_alloc();
+}
+// GCC sees these free() memory it only knows came from operator new once
+// they're inlined into a caller, and warns even though the two match
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Re-simulates a replay as fast as possible. Exits non-zero if it doesn't end
+// in the state it was recorded with, so it can drive git bisect run.
+// Its board is looked up by hash in sMapFile if one is given.
+int PlayReplay(const std::string& sFile, const std::string& sMapFile)
+{
+    CombatReplay replay;
+    if (!replay.Load(sFile)) {
+        std::cerr << "Couldn't load replay " << sFile << "\n";
+        return 1;
+    }
+    auto board = CombatBoard::Default();
+    if (!sMapFile.empty()) {
+        CombatMapFile maps;
+        int nIndex = maps.Open(sMapFile) ? maps.Find(replay.nBoardHash) : -1;
+        board = (nIndex >= 0) ? maps.Board(nIndex) : nullptr;
+    }
+    if (!board || replay.nBoardHash != board->nHash) {
+        std::cerr << "Replay was recorded on a board " << (sMapFile.empty() ? "other than the default" : "not in " + sMapFile) << "\n";
+        return 1;
+    }
+    if (!replay.rules.Problem(*board).empty()) {
+        std::cerr << "Can't replay " << sFile << ": " << replay.rules.Problem(*board) << "\n";
+        return 1;
+    }
 
-                // Do the sort
-                std::sort(z.begin(), z.end(), [](const std::pair<int, float>& a, const std::pair<int, float>& b)
-                    {
-                        return a.second < b.second;
-                    });
-
-                // Now resolve the collision in correct order 
-                for (auto j : z) {
-                    if (olc::aabb::ResolveDynamicRectVsRect(&(*curTank).bullet, fElapsedTime, &vRects[j.first])) {
-                        // Collided with object is opponent tank
-                        if (((*curoppTank).tankRect.pos.x == vRects[j.first].pos.x) && ((*curoppTank).tankRect.pos.y == vRects[j.first].pos.y)) {  
-                            (*curoppTank).spinning = true; (*curTank).score += 1;
-                            if ((*curTank).score > 99)
-                                (*curTank).score = 0;
-                        //    olc::SOUND::StopSample(sndIdle);                       
-                        //    olc::SOUND::PlaySample(sndPow);
-                            (*curoppTank).tankRect.vel += (2 * (*curTank).bullet.vel); //Blown back
-                            otherTank.bullet_exists = false;  //Pause fighting
-                            fAccumTime = 0;                        
-                        }
-                        (*curTank).bullet.vel = { 0,0 };
-                     }
-                    
+    CombatSim sim;
+    sim.Create(board, replay.rules);
+    auto tp1 = std::chrono::steady_clock::now();
+    for (int t = 0; t < replay.Ticks(); t++)
+        sim.Tick(replay.Input(t), replay.Input2(t));
+    auto tp2 = std::chrono::steady_clock::now();
+    double fSeconds = std::chrono::duration<double>(tp2 - tp1).count();
+
+    bool bMatch = sim.StateHash() == replay.nFinalHash || replay.nFinalHash == 0;
+    std::cout << "Replayed " << replay.Ticks() << " ticks in " << fSeconds << "s (" << replay.Ticks() / fSeconds << " ticks/s)\n";
+    std::cout << "Score: red " << sim.TeamTotal(sim.tanks.aScore, 0) << ", blue " << sim.TeamTotal(sim.tanks.aScore, 1) << "\n";
+    std::cout << "Final state hash: " << std::hex << sim.StateHash();
+    if (replay.nFinalHash == 0)
+        std::cout << "; the recording is too old to check against\n";
+    else if (bMatch)
+        std::cout << " matches the recording\n";
+    else
+        std::cout << ", the recording ended at " << replay.nFinalHash << "\n";
+    std::cout << std::dec;
+    return bMatch ? 0 : 2;
+}
+
+// Plays two-player matches between two rollback sessions whose inputs reach
+// each other nDelay ticks late (plus up to nJitter more), and checks both
+// sides end exactly where a plain sim fed the real inputs does
+int RunRollbackTest(std::shared_ptr<const CombatBoard> board, int nMatches, uint32_t nSeed, int nDelay, int nJitter, CombatRules rules)
+{
+    rules.bTwoPlayer = true;
+    std::mt19937 rngJitter(nSeed);
+    int nAgreed = 0, nStalls = 0;
+    long long nRollbacks = 0, nResimTicks = 0, nAdvances = 0;
+    int nMaxResim = 0;
+    double fAdvanceSeconds = 0, fMaxAdvance = 0;
+
+    for (int m = 0; m < nMatches; m++) {
+        struct Message { int nArrival, nTick; CombatInput input; };
+        std::array<CombatRollback, 2> peers;
+        std::array<RandomBot, 2> bots = { RandomBot(nSeed + m), RandomBot((nSeed + m) ^ 0x9E3779B9u) };
+        std::array<std::deque<Message>, 2> inFlight;        // To each peer, in arrival order
+        std::array<std::vector<CombatInput>, 2> vInputs;    // What each player really pressed
+        for (int k = 0; k < 2; k++)
+            peers[k].Create(board, rules, k);
+
+        for (int nFrame = 0; ; nFrame++) {
+            bool bDone = true;
+            for (int k = 0; k < 2; k++) {
+                while (!inFlight[k].empty() && inFlight[k].front().nArrival <= nFrame) {
+                    peers[k].AddRemoteInput(inFlight[k].front().nTick, inFlight[k].front().input);
+                    inFlight[k].pop_front();
                 }
-                // UPdate the bullet rectangles position, with its modified velocity
-                (*curTank).bullet.pos += (*curTank).bullet.vel * fElapsedTime;
+                if (peers[k].Tick() >= CombatSim::nMatchTicks) {
+                    bDone = bDone && inFlight[k].empty();
+                    continue;
+                }
+                bDone = false;
+
+                // A stalled side presses the same keys next frame
+                int nTick = peers[k].Tick();
+                if (int(vInputs[k].size()) == nTick)
+                    vInputs[k].push_back(bots[k].Next());
+                auto tp1 = std::chrono::steady_clock::now();
+                bool bAdvanced = peers[k].Advance(vInputs[k][nTick]);
+                double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tp1).count();
+                if (!bAdvanced) {
+                    nStalls++;
+                    continue;
+                }
+                nAdvances++;
+                fAdvanceSeconds += fSeconds;
+                fMaxAdvance = std::max(fMaxAdvance, fSeconds);
+
+                auto& queue = inFlight[1 - k];
+                int nArrival = nFrame + nDelay + (nJitter > 0 ? int(rngJitter() % (nJitter + 1)) : 0);
+                if (!queue.empty())
+                    nArrival = std::max(nArrival, queue.back().nArrival);
+                queue.push_back({ nArrival, nTick, vInputs[k][nTick] });
             }
-            olc::vf2d dp, dn;
-            t = 0, min_t = INFINITY;
-            std::vector<std::pair<int, float>> zz;
+            if (bDone)
+                break;
+        }
 
+        CombatSim reference;
+        reference.Create(board, rules);
+        for (int t = 0; t < CombatSim::nMatchTicks; t++)
+            reference.Tick(vInputs[0][t], vInputs[1][t]);
+
+        uint64_t nHash = reference.StateHash();
+        for (CombatRollback& peer : peers) {
+            peer.Resimulate();
+            nRollbacks += peer.nRollbacks;
+            nResimTicks += peer.nResimTicks;
+            nMaxResim = std::max(nMaxResim, peer.nMaxResim);
+        }
+        if (peers[0].Sim().StateHash() == nHash && peers[1].Sim().StateHash() == nHash)
+            nAgreed++;
+    }
 
-            // Work out collision point, add it to vector along with rect ID
-            for (size_t i = 0; i < vRects.size(); i++)
-            {
-                if (olc::aabb::DynamicRectVsRect(&(*curTank).tankRect, fElapsedTime, vRects[i], cp, cn, t))
-                {
-                    zz.push_back({ i, t });
-                }
-            }
+    std::cout << "Rollback: " << nMatches << " matches, inputs " << nDelay << "-" << nDelay + nJitter << " ticks late\n";
+    std::cout << "Both sides matched the reference in " << nAgreed << "/" << nMatches << " matches\n";
+    std::cout << "Per side and match: " << nRollbacks / (2.0 * std::max(1, nMatches)) << " rollbacks, "
+        << nResimTicks / (2.0 * std::max(1, nMatches)) << " ticks resimulated, " << nStalls / (2.0 * std::max(1, nMatches)) << " stalled frames\n";
+    std::cout << "Longest rollback " << nMaxResim << " ticks; Advance() mean " << 1e6 * fAdvanceSeconds / std::max(1LL, nAdvances)
+        << "us, max " << 1e6 * fMaxAdvance << "us\n";
+    return nAgreed == nMatches ? 0 : 2;
+}
 
-            // Do the sort
-            std::sort(zz.begin(), zz.end(), [](const std::pair<int, float>& a, const std::pair<int, float>& b)
-                {
-                    return a.second < b.second;
-                });
+// Steps nArenas bot matches together, one tick a frame as the attract screen
+// does, until each has played a full match, then checks every arena ended
+// where the same match played alone on one thread does
+int RunArenas(std::shared_ptr<const CombatBoard> board, int nArenas, int nThreads, uint32_t nSeed, const CombatRules& rules)
+{
+    CombatArenas arenas;
+    std::vector<RandomBot> vBots;
+    for (int i = 0; i < nArenas; i++) {
+        arenas.Add(board, rules);
+        vBots.emplace_back(nSeed + uint32_t(i));
+    }
+    arenas.Start(nThreads, [&](int i, const CombatSim&, CombatInput& in, CombatInput&) { in = vBots[i].Next(); });
 
-            // Now resolve the collision in correct order 
-            for (auto j : zz) {
-                if (olc::aabb::ResolveDynamicRectVsRect(&(*curTank).tankRect, fElapsedTime, &vRects[j.first])) {
-                    collision = true;
-                }
+    auto tp1 = std::chrono::steady_clock::now();
+    int nFrames = 0;
+    auto finished = [&]() {
+        for (int i = 0; i < nArenas; i++)
+            if (arenas.Get(i).nMatches == 0)
+                return false;
+        return true;
+    };
+    while (!finished()) {
+        arenas.Step(1);
+        nFrames++;
+    }
+    auto tp2 = std::chrono::steady_clock::now();
+    double fSeconds = std::chrono::duration<double>(tp2 - tp1).count();
+    arenas.Stop();
+
+    int nAgreed = 0;
+    CombatSim sim;
+    for (int i = 0; i < nArenas; i++) {
+        sim.Create(board, rules);
+        RandomBot bot(nSeed + uint32_t(i));
+        while (!sim.MatchOver())
+            sim.Tick(bot.Next());
+        if (sim.StateHash() == arenas.Get(i).nLastHash)
+            nAgreed++;
+        else
+            std::cout << "Arena " << i << " differs from playing alone\n";
+    }
+    std::cout << "Arenas: " << nArenas << " on " << std::min(nThreads, nArenas) << " threads, " << nFrames << " frames in " << fSeconds << "s ("
+        << nFrames / fSeconds << " frames/s, " << double(nFrames) * nArenas / fSeconds << " ticks/s)\n";
+    std::cout << nAgreed << "/" << nArenas << " arenas matched playing alone\n";
+    return nAgreed == nArenas ? 0 : 2;
+}
+
+// Compiles map files, text or binary, into one binary map file holding every
+// board they do, in order
+int PackMaps(const std::string& sOut, const std::vector<std::string>& vFiles)
+{
+    std::vector<std::shared_ptr<const CombatBoard>> vBoards;
+    for (const std::string& sFile : vFiles) {
+        CombatMapFile maps;
+        if (!maps.Open(sFile)) {
+            std::cerr << "Couldn't load map " << sFile << ": " << maps.sError << "\n";
+            return 1;
+        }
+        for (int i = 0; i < maps.Count(); i++) {
+            auto board = maps.Board(i);
+            if (!board) {
+                std::cerr << "Couldn't load board " << i << " of " << sFile << ": " << maps.sError << "\n";
+                return 1;
             }
-            (*curTank).tankRect.pos += (*curTank).tankRect.vel * fElapsedTime; //Upade position of tank
+            std::cout << "Board " << vBoards.size() << ": " << sFile << " #" << i << ", " << board->nBoardWidth << "x" << board->nBoardHeight
+                << " tiles, " << board->vRects.size() << " wall rects, hash " << std::hex << board->nHash << std::dec << "\n";
+            vBoards.push_back(board);
+        }
+    }
+    if (!CombatMapFile::Save(sOut, vBoards)) {
+        std::cerr << "Couldn't save " << sOut << "\n";
+        return 1;
+    }
+    std::cout << "Saved " << vBoards.size() << " boards to " << sOut << "\n";
+    return 0;
+}
 
+// Generates nBoards boards from seeds nSeed on, timing generation and
+// validation alone, then optionally compiles them into a binary map file
+int GenerateMaps(int nBoards, uint32_t nSeed, const std::string& sOut)
+{
+    CombatGenParams params;
+    std::vector<PackedBoard> vBoards(std::max(0, nBoards));
+    int nAttempts = 0, nFailed = 0;
+    auto tStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < int(vBoards.size()); i++) {
+        int n = CombatBoardGen::Generate(nSeed + uint64_t(i), params, vBoards[i]);
+        nAttempts += n ? n : CombatBoardGen::nMaxAttempts;
+        nFailed += n ? 0 : 1;
+    }
+    double fSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+    std::cout << vBoards.size() - nFailed << " of " << vBoards.size() << " boards in " << fSeconds << "s (" << (fSeconds > 0 ? double(vBoards.size()) / fSeconds : 0.0)
+        << " boards/s), " << (vBoards.empty() ? 0.0 : double(nAttempts) / vBoards.size()) << " drawn per valid board\n";
+    if (nFailed > 0) {
+        std::cerr << nFailed << " seeds found no valid board in " << CombatBoardGen::nMaxAttempts << " draws\n";
+        return 2;
+    }
+    if (sOut.empty())
+        return 0;
+
+    std::vector<std::shared_ptr<const CombatBoard>> vCompiled;
+    for (const PackedBoard& b : vBoards)
+        vCompiled.push_back(CombatBoardGen::Compile(b, params));
+    if (!CombatMapFile::Save(sOut, vCompiled)) {
+        std::cerr << "Couldn't save " << sOut << "\n";
+        return 1;
+    }
+    std::cout << "Saved " << vCompiled.size() << " boards to " << sOut << "\n";
+    return 0;
+}
 
-            if (collision) {
-                collision = false;
-                if (((*curTank).tankRect.pos.x == otherTank.tankRect.pos.x) && ((*curTank).tankRect.pos.y == otherTank.tankRect.pos.y))
-                    blocked = true;
-            }
+// Runs every SweepRects implementation this CPU has on nCases random sweeps
+// and checks each gives the scalar reference's hits, in order and to the
+// bit. Cases mix tank- and bullet-sized movers, edges that touch exactly,
+// axis-parallel and tiny velocities, store sizes off the vector width and
+// gathered index lists. Exits non-zero on any difference.
+int CheckSweepPaths(int nCases, uint32_t nSeed)
+{
+    using olc::aabb::rect;
+    using olc::aabb::sweep_path;
+    using Sweep = int (*)(const rect*, const float, const olc::aabb::rect_soa&, const int*, int, int, std::pair<int, float>*);
+    struct Path { const char* sName; Sweep fn; int nMismatches; };
+    std::vector<Path> vPaths;
+#if defined(OLC_AABB_X86)
+    vPaths.push_back({ "sse2", olc::aabb::SweepRectsSSE2, 0 });
+    if (olc::aabb::DetectSweepPath() == sweep_path::avx2)
+        vPaths.push_back({ "avx2", olc::aabb::SweepRectsAVX2, 0 });
+#endif
+
+    std::mt19937 rng(nSeed);
+    auto uniform = [&](float a, float b) { return std::uniform_real_distribution<float>(a, b)(rng); };
+    // Whole pixels half the time, so edges line up and contact times land on 0 and 1
+    auto coord = [&](float a, float b) { return (rng() % 2) ? std::floor(uniform(a, b)) : uniform(a, b); };
+    const float dt = CombatSim::fTickTime;
+
+    olc::aabb::rect_soa store;
+    std::vector<rect> vRects;
+    std::vector<int> vIdx;
+    std::vector<std::pair<int, float>> vRef, vHits;
+    long long nRefHits = 0;
+    for (int c = 0; c < nCases; c++) {
+        vRects.resize(rng() % 40);
+        for (rect& r : vRects)
+            r = { { coord(0, 96), coord(0, 96) }, { coord(1, 24), coord(1, 24) } };
+        store.Build(vRects);
+
+        olc::vf2d vSize = (rng() % 2) ? olc::vf2d{ 1, 1 } : olc::vf2d{ 8, 8 };
+        rect mover = { { coord(-8, 104), coord(-8, 104) }, vSize };
+        float fSpeed = std::pow(10.0f, uniform(-3, 4));
+        switch (rng() % 4) {
+        case 0: mover.vel = { fSpeed * ((rng() % 2) ? 1.0f : -1.0f), 0 }; break;
+        case 1: mover.vel = { 0, fSpeed * ((rng() % 2) ? 1.0f : -1.0f) }; break;
+        case 2: mover.vel = { 0, 0 }; break;
+        default: {
+            float fAngle = uniform(0, 6.2831853f);
+            mover.vel = { fSpeed * std::cos(fAngle), fSpeed * std::sin(fAngle) };
+        }
+        }
+        // Aim at a rect's near edge so a good share of cases hit
+        if (!vRects.empty() && (rng() % 2)) {
+            const rect& w = vRects[rng() % vRects.size()];
+            olc::vf2d vTarget = { coord(w.pos.x - vSize.x, w.pos.x + w.size.x), coord(w.pos.y - vSize.y, w.pos.y + w.size.y) };
+            mover.vel = (vTarget - mover.pos) / dt * ((rng() % 2) ? 1.0f : uniform(0.5f, 2.0f));
+        }
 
-            vRects.pop_back(); //remove opponent tank from vector
-        }return true;
+        bool bGather = rng() % 2;
+        vIdx.clear();
+        for (int i = 0; i < int(vRects.size()); i++)
+            if (!bGather || (rng() % 4))
+                vIdx.push_back(i);
+        std::shuffle(vIdx.begin(), vIdx.end(), rng);
+        const int* idx = bGather ? vIdx.data() : nullptr;
+        int nIdx = bGather ? int(vIdx.size()) : int(vRects.size());
+
+        vRef.resize(vRects.size());
+        vHits.resize(vRects.size());
+        int nRef = olc::aabb::SweepRectsScalar(&mover, dt, store, idx, 0, nIdx, vRef.data());
+        nRefHits += nRef;
+        for (Path& path : vPaths) {
+            int nHits = path.fn(&mover, dt, store, idx, 0, nIdx, vHits.data());
+            bool bSame = nHits == nRef;
+            for (int h = 0; bSame && h < nHits; h++)
+                bSame = vHits[h].first == vRef[h].first && std::memcmp(&vHits[h].second, &vRef[h].second, sizeof(float)) == 0;
+            if (!bSame && path.nMismatches++ < 5)
+                std::cout << path.sName << " differs from scalar in case " << c << ": " << nHits << " hits against " << nRef << "\n";
+        }
+    }
 
+    int nMismatches = 0;
+    std::cout << "Sweep paths: " << nCases << " cases, " << nRefHits << " hits\n";
+    for (const Path& path : vPaths) {
+        std::cout << path.sName << ": " << path.nMismatches << " cases differ from scalar\n";
+        nMismatches += path.nMismatches;
     }
-     bool OnUserDestroy()
-            {
-                //olc::SOUND::DestroyAudio();
-                return true;
-            }
-};
- 
+    if (vPaths.empty())
+        std::cout << "Only the scalar path is built for this CPU\n";
+    return nMismatches == 0 ? 0 : 2;
+}
 
+// Two-player setups where one tank drives straight at the other, parked
+// against the board's outer wall, from a range of gaps and distances and
+// with either tank doing the pushing. Fails if either tank ever ends a tick
+// overlapping a wall or off the board.
+int CheckTankPushes()
+{
+    auto board = CombatBoard::Default();
+    const float fTile = float(board->nSquareSize);
+    const olc::vf2d vArena = { board->nBoardWidth * fTile, board->nBoardHeight * fTile };
+    const olc::vf2d vTank = CombatSim::vTankSize;
+    // Toward each side: unit direction and the aAng that gives that heading
+    const struct { olc::vf2d vDir; float fAng; } aSides[4] = {
+        { { -1, 0 }, float(8.5 * PI / 8) }, { { 1, 0 }, 0.0f }, { { 0, -1 }, float(4.5 * PI / 8) }, { { 0, 1 }, float(12.5 * PI / 8) }
+    };
+
+    int nSetups = 0, nFailed = 0;
+    for (bool bDeterministic : { false, true }) {
+        CombatRules rules;
+        rules.bTwoPlayer = true;
+        rules.bDeterministic = bDeterministic;
+        CombatSim sim;
+        for (const auto& side : aSides) {
+            bool bAcross = side.vDir.x != 0;
+            float fLength = bAcross ? vArena.y : vArena.x;
+            for (float fLane = fTile; fLane + vTank.y <= fLength - fTile; fLane += 12)
+                for (float fGap : { 0.0f, 0.25f, 0.5f }) {
+                    // Parked flush (or fGap short of) the inside of the side wall
+                    olc::vf2d vParked = bAcross
+                        ? olc::vf2d{ side.vDir.x < 0 ? fTile + fGap : vArena.x - fTile - vTank.x - fGap, fLane }
+                        : olc::vf2d{ fLane, side.vDir.y < 0 ? fTile + fGap : vArena.y - fTile - vTank.y - fGap };
+                    for (float fDist = 8.0f; fDist <= 16.0f; fDist += 0.5f)
+                        for (int nPusher = 0; nPusher < 2; nPusher++) {
+                            olc::vf2d vPusher = vParked - side.vDir * fDist;
+                            // Clear between them, with wall right behind the parked tank at both its corners
+                            olc::aabb::rect lane = { vParked.min(vPusher), vTank + vParked.max(vPusher) - vParked.min(vPusher) };
+                            olc::vf2d vBehind = vParked + vTank / 2 + side.vDir * (vTank.x / 2 + fGap + 0.5f), vAlong = { side.vDir.y * 3.5f, side.vDir.x * 3.5f };
+                            olc::aabb::rect aBehind[2] = { { vBehind + vAlong - olc::vf2d{ 0.25f, 0.25f }, { 0.5f, 0.5f } }, { vBehind - vAlong - olc::vf2d{ 0.25f, 0.25f }, { 0.5f, 0.5f } } };
+                            if (board->AnyWall(lane) || !board->AnyWall(aBehind[0]) || !board->AnyWall(aBehind[1]))
+                                continue;
+                            sim.Create(board, rules);
+                            sim.tanks.aPos[1 - nPusher] = vParked;
+                            sim.tanks.aPos[nPusher] = vPusher;
+                            sim.tanks.aAng[nPusher] = side.fAng;
+                            CombatInput drive;
+                            drive.bUp = true;
+                            nSetups++;
+                            for (int t = 0; t < 60; t++) {
+                                sim.Tick(nPusher == 0 ? drive : CombatInput(), nPusher == 1 ? drive : CombatInput());
+                                bool bWall = false;
+                                for (int i = 0; i < 2; i++) {
+                                    olc::aabb::rect tank = { sim.tanks.aPos[i], vTank };
+                                    bWall = bWall || tank.pos.x < 0 || tank.pos.y < 0 || board->AnyWall(tank);
+                                }
+                                if (bWall) {
+                                    if (nFailed++ < 5)
+                                        std::cout << (bDeterministic ? "Deterministic" : "Float") << ": tank " << 1 - nPusher << " parked at (" << vParked.x << ", " << vParked.y
+                                            << "), pushed from " << fDist << " away, is in a wall at (" << sim.tanks.aPos[1 - nPusher].x << ", " << sim.tanks.aPos[1 - nPusher].y
+                                            << ") after " << t + 1 << " ticks\n";
+                                    break;
+                                }
+                            }
+                        }
+                }
+        }
+    }
+    std::cout << "Pushes: " << nSetups << " setups, " << nFailed << " ended with a tank in a wall\n";
+    return nFailed == 0 ? 0 : 2;
+}
 
+// Times the olc::aabb routines, PathService queries and/or whole ticks over
+// the scenario corpus plus any replays given, optionally saving the results and holding them to
+// a baseline saved earlier. Exits non-zero if anything got more than
+// fTolerance slower or started allocating, so a change to olcAABB.h or
+// CombatSim can be gated on it.
+int RunBenchmarks(bool bAabb, bool bPath, bool bTick, int nThreads, const std::vector<std::string>& vReplays, int nReps,
+    const std::string& sOut, const std::string& sBaseline, double fTolerance)
+{
+#if defined(_DEBUG)
+    std::cout << "Debug build: timings won't be representative\n";
+#endif
+    CombatBench bench;
+    bench.nReps = nReps;
+    bench.pAllocations = &nAllocations;
+    if (bAabb)
+        AabbBenchmarks(bench);
+    if (bPath)
+        PathBenchmarks(bench, nThreads, std::cout);
+    if (bTick) {
+        std::vector<TickScenario> vScenarios = TickScenarios();
+        for (const std::string& sFile : vReplays) {
+            TickScenario sc = { "replay:" + sFile, {} };
+            if (!sc.replay.Load(sFile) || sc.replay.nBoardHash != CombatBoard::Default()->nHash) {
+                std::cerr << "Couldn't load replay " << sFile << " for the default board\n";
+                return 1;
+            }
+            vScenarios.push_back(std::move(sc));
+        }
+        TickBenchmarks(bench, vScenarios, std::cout);
+    }
+    std::cout << "Median of " << bench.nReps << " runs\n";
+    bench.Print(std::cout);
+    if (!sOut.empty())
+        std::cout << (bench.SaveCSV(sOut) ? "Saved" : "Couldn't save") << " " << sOut << "\n";
+    if (sBaseline.empty())
+        return 0;
+
+    std::cout << "Against " << sBaseline << ", tolerance " << 100 * fTolerance << "%\n";
+    int nRegressions = bench.Compare(sBaseline, fTolerance, std::cout);
+    if (nRegressions < 0) {
+        std::cerr << "Couldn't load baseline " << sBaseline << "\n";
+        return 1;
+    }
+    std::cout << nRegressions << " regression" << (nRegressions == 1 ? "" : "s") << "\n";
+    return nRegressions == 0 ? 0 : 2;
+}
 
-int main()
+int main(int argc, char* argv[])
+{
+    int nMatches = 100;
+    uint32_t nSeed = 1;
+    int nThreads = int(std::max(1u, std::thread::hardware_concurrency()));
+    CombatRules rules;
+    std::string sRecord;
+    int nRollbackDelay = -1, nJitter = 0;
+    int nArenas = 0;
+    std::string sReplay, sMapFile, sPackOut;
+    int nMapIndex = 0;
+    std::vector<std::string> vPackFiles;
+    int nGenBoards = -1;
+    std::string sGenOut;
+    bool bBenchAabb = false, bBenchPath = false, bBenchTick = false;
+    int nBenchReps = 15;
+    std::string sBenchOut, sBenchBaseline;
+    std::vector<std::string> vBenchReplays;
+    double fBenchTolerance = 0.1;
+    int nSweepCases = -1;
+    bool bCheckPush = false;
+    for (int a = 1; a < argc; a++) {
+        std::string sArg = argv[a];
+        if (sArg == "--matches" && a + 1 < argc) nMatches = std::atoi(argv[++a]);
+        else if (sArg == "--seed" && a + 1 < argc) nSeed = uint32_t(std::strtoul(argv[++a], nullptr, 10));
+        else if (sArg == "--threads" && a + 1 < argc) nThreads = std::atoi(argv[++a]);
+        else if (sArg == "--score-limit" && a + 1 < argc) rules.nScoreLimit = std::atoi(argv[++a]);
+        else if (sArg == "--ai-speed" && a + 1 < argc) rules.fAISpeed = float(std::atof(argv[++a]));
+        else if (sArg == "--ai-fire-delay" && a + 1 < argc) rules.fAIFireDelay = float(std::atof(argv[++a]));
+        else if (sArg == "--deterministic") rules.bDeterministic = true;
+        else if (sArg == "--flow-ai") rules.bFlowAI = true;
+        else if (sArg == "--path-ai") rules.bPathAI = true;
+        else if (sArg == "--sight-ai") rules.bSightAI = true;
+        else if (sArg == "--tanks" && a + 1 < argc) rules.nTanks = std::atoi(argv[++a]);
+        else if (sArg == "--bullets" && a + 1 < argc) rules.nBulletsPerTank = std::atoi(argv[++a]);
+        else if (sArg == "--record" && a + 1 < argc) sRecord = argv[++a];
+        else if (sArg == "--replay" && a + 1 < argc) sReplay = argv[++a];
+        else if (sArg == "--map" && a + 1 < argc) sMapFile = argv[++a];
+        else if (sArg == "--map-index" && a + 1 < argc) nMapIndex = std::atoi(argv[++a]);
+        else if (sArg == "--pack-maps" && a + 2 < argc) {
+            sPackOut = argv[++a];
+            vPackFiles.assign(argv + a + 1, argv + argc);
+            a = argc;
+        }
+        else if (sArg == "--gen-maps" && a + 1 < argc) nGenBoards = std::atoi(argv[++a]);
+        else if (sArg == "--gen-out" && a + 1 < argc) sGenOut = argv[++a];
+        else if (sArg == "--rollback" && a + 1 < argc) nRollbackDelay = std::atoi(argv[++a]);
+        else if (sArg == "--jitter" && a + 1 < argc) nJitter = std::atoi(argv[++a]);
+        else if (sArg == "--arenas" && a + 1 < argc) nArenas = std::atoi(argv[++a]);
+        else if (sArg == "--check-sweep" && a + 1 < argc) nSweepCases = std::atoi(argv[++a]);
+        else if (sArg == "--check-push") bCheckPush = true;
+        else if (sArg == "--bench-aabb") bBenchAabb = true;
+        else if (sArg == "--bench-path") bBenchPath = true;
+        else if (sArg == "--bench-tick") bBenchTick = true;
+        else if (sArg == "--bench-replay" && a + 1 < argc) vBenchReplays.push_back(argv[++a]);
+        else if (sArg == "--bench-reps" && a + 1 < argc) nBenchReps = std::atoi(argv[++a]);
+        else if (sArg == "--bench-out" && a + 1 < argc) sBenchOut = argv[++a];
+        else if (sArg == "--bench-baseline" && a + 1 < argc) sBenchBaseline = argv[++a];
+        else if (sArg == "--bench-tolerance" && a + 1 < argc) fBenchTolerance = std::atof(argv[++a]) / 100.0;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--matches N] [--seed S] [--threads T] [--deterministic] [--map FILE [--map-index N]]\n"
+                << "       [--tanks N] [--bullets N] [--score-limit N] [--ai-speed S] [--ai-fire-delay SECONDS] [--flow-ai] [--path-ai]\n"
+                << "       [--sight-ai] [--record FILE]\n"
+                << "       " << argv[0] << " --replay FILE [--map FILE]\n"
+                << "       " << argv[0] << " --pack-maps OUT FILE...\n"
+                << "       " << argv[0] << " --gen-maps N [--seed S] [--gen-out FILE]\n"
+                << "       " << argv[0] << " --rollback DELAY [--jitter TICKS] [--matches N] [--seed S] [--deterministic]\n"
+                << "       " << argv[0] << " --arenas K [--threads T] [--seed S] [--deterministic]\n"
+                << "       " << argv[0] << " --check-sweep N [--seed S]\n"
+                << "       " << argv[0] << " --check-push\n"
+                << "       " << argv[0] << " [--bench-aabb] [--bench-path [--threads T]] [--bench-tick [--bench-replay FILE]...]\n"
+                << "       [--bench-reps N] [--bench-out FILE] [--bench-baseline FILE] [--bench-tolerance PCT]\n";
+            return 1;
+        }
+    }
+    if (rules.nTanks < 2 || rules.nTanks > CombatState::nMaxTanks || rules.nBulletsPerTank < 1 || rules.nBulletsPerTank > CombatState::nMaxBulletsPerTank) {
+        std::cerr << "--tanks must be 2-" << CombatState::nMaxTanks << " and --bullets 1-" << CombatState::nMaxBulletsPerTank << "\n";
+        return 1;
+    }
+    if (!sPackOut.empty())
+        return PackMaps(sPackOut, vPackFiles);
+    if (nGenBoards >= 0)
+        return GenerateMaps(nGenBoards, nSeed, sGenOut);
+    if (!sReplay.empty())
+        return PlayReplay(sReplay, sMapFile);
+    if (nSweepCases >= 0)
+        return CheckSweepPaths(nSweepCases, nSeed);
+    if (bCheckPush)
+        return CheckTankPushes();
+    if (bBenchAabb || bBenchPath || bBenchTick)
+        return RunBenchmarks(bBenchAabb, bBenchPath, bBenchTick, nThreads, vBenchReplays, nBenchReps, sBenchOut, sBenchBaseline, fBenchTolerance);
+    auto board = LoadBoard(sMapFile, nMapIndex);
+    if (!board)
+        return 1;
+    if (!rules.Problem(*board).empty()) {
+        std::cerr << "Can't play that board: " << rules.Problem(*board) << "\n";
+        return 1;
+    }
+    if (nRollbackDelay >= 0)
+        return RunRollbackTest(board, nMatches, nSeed, nRollbackDelay, nJitter, rules);
+    if (nArenas > 0)
+        return RunArenas(board, nArenas, nThreads, nSeed, rules);
+
+    std::cout << "Board: " << BoardSummary(*board) << "\n";
+
+    std::vector<CombatMatchSpec> vSpecs(std::max(0, nMatches));
+    for (int m = 0; m < int(vSpecs.size()); m++)
+        vSpecs[m] = { nSeed + uint32_t(m), board, rules };
+
+    // --record keeps the first match
+    CombatReplay replay;
+    replay.vInputs.reserve(CombatSim::nMatchTicks);
+    CombatFarmReport report = CombatFarm::Run(vSpecs, nThreads, [&](const CombatMatchSpec& spec, CombatSim& sim) {
+        bool bRecord = !sRecord.empty() && &spec == &vSpecs[0];
+        if (bRecord)
+            replay.Begin(sim, spec.nSeed);
+        RandomBot bot(spec.nSeed);
+        while (!sim.MatchOver()) {
+            CombatInput in = bot.Next();
+            size_t nBefore = nAllocations;
+            sim.Tick(in);
+            assert((nAllocations == nBefore || sim.board->bStreamed) && "CombatSim::Tick allocated");   // Streamed boards do when a chunk comes in
+            (void)nBefore;
+            if (bRecord)
+                replay.Record(in);
+        }
+        if (bRecord)
+            replay.Finish(sim);
+    });
+    if (!sRecord.empty())
+        std::cout << (replay.Save(sRecord) ? "Saved" : "Couldn't save") << " replay of match 0 to " << sRecord << "\n";
+
+    std::cout << report.nMatches << " matches on " << report.nThreads << " threads, " << report.nTicks << " ticks in " << report.fSeconds << "s ("
+        << report.MatchesPerSecond() << " matches/s, " << report.TicksPerSecond() << " ticks/s)\n";
+    if (report.nMatches > 0)
+        std::cout << "Match length: " << report.nMinTicks << "-" << report.nMaxTicks << " ticks, mean " << double(report.nTicks) / report.nMatches << "\n";
+    auto minmax = std::minmax_element(report.vMatchesPerThread.begin(), report.vMatchesPerThread.end());
+    if (minmax.first != report.vMatchesPerThread.end())
+        std::cout << "Matches per thread: " << *minmax.first << "-" << *minmax.second << "\n";
+    std::cout << "Score: red " << report.nScore[0] << ", blue " << report.nScore[1] << "\n";
+    std::cout << "Hits/shots: red " << report.nHits[0] << "/" << report.nShots[0] << ", blue " << report.nHits[1] << "/" << report.nShots[1] << "\n";
+    std::cout << "Final state hash: " << std::hex << report.nHash << std::dec << (rules.bDeterministic ? " (deterministic)" : "") << "\n";
+    return 0;
+}
+#else
+// Usage: Combat [--replay FILE] [--tanks N] [--bullets N] [--flow-ai] [--path-ai] [--sight-ai] [--arenas K] [--map FILE [--map-index N]]
+// --arenas fills the window with K bot matches instead of a game
+int main(int argc, char* argv[])
 {
     Combat game;
-    game.Construct(188, 136, 6, 6);
+    std::string sMapFile;
+    int nMapIndex = 0;
+    for (int a = 1; a < argc; a++) {
+        std::string sArg = argv[a];
+        if (sArg == "--replay" && a + 1 < argc) {
+            if (!game.LoadReplay(argv[++a])) {
+                std::cerr << "Couldn't load replay " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (sArg == "--tanks" && a + 1 < argc) game.rules.nTanks = std::atoi(argv[++a]);
+        else if (sArg == "--bullets" && a + 1 < argc) game.rules.nBulletsPerTank = std::atoi(argv[++a]);
+        else if (sArg == "--flow-ai") game.rules.bFlowAI = true;
+        else if (sArg == "--path-ai") game.rules.bPathAI = true;
+        else if (sArg == "--sight-ai") game.rules.bSightAI = true;
+        else if (sArg == "--arenas" && a + 1 < argc) game.nArenas = std::atoi(argv[++a]);
+        else if (sArg == "--map" && a + 1 < argc) sMapFile = argv[++a];
+        else if (sArg == "--map-index" && a + 1 < argc) nMapIndex = std::atoi(argv[++a]);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--replay FILE] [--tanks N] [--bullets N] [--flow-ai] [--path-ai] [--sight-ai] [--arenas K] [--map FILE [--map-index N]]\n";
+            return 1;
+        }
+    }
+    if (game.rules.nTanks < 2 || game.rules.nTanks > CombatState::nMaxTanks || game.rules.nBulletsPerTank < 1 || game.rules.nBulletsPerTank > CombatState::nMaxBulletsPerTank) {
+        std::cerr << "--tanks must be 2-" << CombatState::nMaxTanks << " and --bullets 1-" << CombatState::nMaxBulletsPerTank << "\n";
+        return 1;
+    }
+    if (game.nArenas < 0 || game.nArenas > 64) {
+        std::cerr << "--arenas must be 0-64\n";
+        return 1;
+    }
+    game.board = LoadBoard(sMapFile, nMapIndex);
+    if (!game.board)
+        return 1;
+    if (!game.rules.Problem(*game.board).empty()) {
+        std::cerr << "Can't play that board: " << game.rules.Problem(*game.board) << "\n";
+        return 1;
+    }
+
+    // The original board's 188x136 at 6x, and others scaled to about the same
+    // window; bigger boards scroll a view of that size
+    olc::vf2d vView = Combat::ViewSize(*game.board);
+    int nWidth = int(vView.x), nHeight = int(vView.y);
+    int nPixel = std::max(1, std::min(1128 / nWidth, 816 / nHeight));
+    game.Construct(nWidth, nHeight, nPixel, nPixel);
     game.Start();
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "CombatSim.h"
+#include "CombatTrace.h"
+
+// Several independent matches in one process, each with its own board and
+// CombatSim, stepped together a frame at a time for attract screens and
+// dashboards. Step() hands the arenas out to a pool of worker threads, the
+// caller included, and returns once every arena has run its ticks, so
+// between Steps the sims belong to the caller alone: the renderer reads them
+// on the main thread without taking a lock. A finished match is counted and
+// a new one started in its place straight away.
+//
+// An arena's input comes from the InputFn given to Start(), called on
+// whichever thread is ticking that arena, so it must touch nothing but that
+// arena's own state.
+class CombatArenas
+{
+public:
+    // Fills in the inputs for the next tick of arena nArena
+    using InputFn = std::function<void(int nArena, const CombatSim& sim, CombatInput& in, CombatInput& in2)>;
+
+    struct Arena
+    {
+        std::shared_ptr<const CombatBoard> board;
+        CombatRules rules;
+        CombatSim sim;
+        int nMatches = 0;               // Played to the end
+        uint64_t nLastHash = 0;         // CombatSim::StateHash() at the end of the last one
+    };
+
+    ~CombatArenas() { Stop(); }
+
+    // Before Start(); board null plays CombatBoard::Default()
+    void Add(std::shared_ptr<const CombatBoard> board, const CombatRules& rules)
+    {
+        assert(vWorkers.empty() && "Arenas can't be added once started");
+        auto a = std::make_unique<Arena>();
+        a->board = board ? std::move(board) : CombatBoard::Default();
+        a->rules = rules;
+        a->sim.Create(a->board, a->rules);
+        vArenas.push_back(std::move(a));
+    }
+
+    int Count() const { return int(vArenas.size()); }
+    const Arena& Get(int i) const { return *vArenas[i]; }
+
+    // Starts nThreads - 1 workers; the thread calling Step() is the last
+    void Start(int nThreads, InputFn fn)
+    {
+        Stop();
+        fnInput = std::move(fn);
+        nThreads = std::max(1, std::min(nThreads, Count()));
+        for (int t = 1; t < nThreads; t++)
+            vWorkers.emplace_back([this]() { Worker(); });
+    }
+
+    // Advances every arena by nTicks, in parallel, and returns when all are done
+    void Step(int nTicks)
+    {
+        if (nTicks <= 0 || vArenas.empty())
+            return;
+        nStepTicks = nTicks;
+        nDone.store(0, std::memory_order_relaxed);
+        nNext.store(0, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mux);
+            nGeneration++;
+        }
+        cvStart.notify_all();
+        Work();
+        std::unique_lock<std::mutex> lock(mux);
+        cvDone.wait(lock, [&]() { return nDone.load(std::memory_order_acquire) == Count(); });
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mux);
+            bQuit = true;
+        }
+        cvStart.notify_all();
+        for (auto& th : vWorkers)
+            th.join();
+        vWorkers.clear();
+        bQuit = false;
+    }
+
+private:
+    std::vector<std::unique_ptr<Arena>> vArenas;    // Apart, so workers don't share cache lines
+    InputFn fnInput;
+    std::vector<std::thread> vWorkers;
+    std::mutex mux;
+    std::condition_variable cvStart, cvDone;
+    uint64_t nGeneration = 0;           // Bumped by every Step; guarded by mux
+    bool bQuit = false;
+    int nStepTicks = 0;
+    std::atomic<int> nNext{ 0 };        // Next arena to hand out this Step
+    std::atomic<int> nDone{ 0 };        // Arenas finished this Step
+
+    void Worker()
+    {
+        TraceRecorder::NameThread("arena worker");
+        uint64_t nSeen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mux);
+                cvStart.wait(lock, [&]() { return bQuit || nGeneration != nSeen; });
+                if (bQuit)
+                    return;
+                nSeen = nGeneration;
+            }
+            Work();
+        }
+    }
+
+    // Takes arenas until none are left. A worker that wakes late only finds
+    // the counter already past the end.
+    void Work()
+    {
+        for (int i = nNext.fetch_add(1, std::memory_order_acq_rel); i < Count(); i = nNext.fetch_add(1, std::memory_order_acq_rel)) {
+            TraceRecorder::Scope trace("arena");
+            Arena& a = *vArenas[i];
+            for (int t = 0; t < nStepTicks; t++) {
+                CombatInput in, in2;
+                fnInput(i, a.sim, in, in2);
+                a.sim.Tick(in, in2);
+                if (a.sim.MatchOver()) {
+                    a.nLastHash = a.sim.StateHash();
+                    a.nMatches++;
+                    a.sim.Create(a.board, a.rules);
+                }
+            }
+            if (nDone.fetch_add(1, std::memory_order_acq_rel) + 1 == Count()) {
+                std::lock_guard<std::mutex> lock(mux);
+                cvDone.notify_one();
+            }
+        }
+    }
+};
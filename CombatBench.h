@@ -0,0 +1,535 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "CombatSim.h"
+#include "CombatReplay.h"
+
+// Timings for one benchmark, per operation, over all its repetitions
+struct BenchResult
+{
+    std::string sName;
+    long long nOps = 0;                 // Operations per repetition
+    double fMedianNs = 0, fMinNs = 0, fMeanNs = 0, fStdDevNs = 0;
+    double fHitRate = 0;                // Share of operations that reported a hit
+    double fAllocsPerOp = -1;           // Heap allocations per operation, or -1 if not counted
+
+    double OpsPerSecond() const { return fMedianNs > 0 ? 1e9 / fMedianNs : 0; }
+};
+
+// Runs each benchmark once to warm up and then nReps more times, timing every
+// repetition on its own, and keeps the per-op median, min, mean and spread.
+// A benchmark is a pass over data built beforehand, so the timed loop
+// neither allocates nor draws random numbers; it returns its hit count,
+// which goes to nSink so the compiler can't drop the work.
+//
+// The median is what Compare() gates on: results saved with SaveCSV on one
+// build are the baseline a later build of the same machine must stay within
+// a tolerance of.
+class CombatBench
+{
+public:
+    int nReps = 15;
+    std::vector<BenchResult> vResults;
+
+    // Allocation counter of the benchmarking thread, read around each pass if set
+    const size_t* pAllocations = nullptr;
+
+    static inline volatile uint64_t nSink = 0;
+
+    // fnPass() does nOps operations and returns how many of them hit
+    template<typename F>
+    void Run(const std::string& sName, long long nOps, F&& fnPass)
+    {
+        nSink = nSink + uint64_t(fnPass());
+        std::vector<double> vNs(size_t(std::max(1, nReps)));
+        long long nHits = 0;
+        size_t nAllocs = 0;
+        for (double& fNs : vNs) {
+            size_t nBefore = pAllocations ? *pAllocations : 0;
+            auto tp1 = clock::now();
+            nHits = fnPass();
+            auto tp2 = clock::now();
+            nAllocs += pAllocations ? *pAllocations - nBefore : 0;
+            nSink = nSink + uint64_t(nHits);
+            fNs = std::chrono::duration<double, std::nano>(tp2 - tp1).count() / double(nOps);
+        }
+
+        BenchResult res;
+        res.sName = sName;
+        res.nOps = nOps;
+        res.fHitRate = double(nHits) / double(nOps);
+        if (pAllocations)
+            res.fAllocsPerOp = double(nAllocs) / (double(nOps) * double(vNs.size()));
+        std::sort(vNs.begin(), vNs.end());
+        size_t n = vNs.size();
+        res.fMedianNs = (n % 2) ? vNs[n / 2] : 0.5 * (vNs[n / 2 - 1] + vNs[n / 2]);
+        res.fMinNs = vNs[0];
+        for (double f : vNs)
+            res.fMeanNs += f / double(n);
+        for (double f : vNs)
+            res.fStdDevNs += (f - res.fMeanNs) * (f - res.fMeanNs) / double(n);
+        res.fStdDevNs = std::sqrt(res.fStdDevNs);
+        vResults.push_back(res);
+    }
+
+    void Print(std::ostream& os) const
+    {
+        char sLine[160];
+        snprintf(sLine, sizeof(sLine), "%-40s%10s%8s%10s%10s%7s%11s", "benchmark", "ns/op", "+-%", "min", "Mops/s", "hit%", "allocs/op");
+        os << sLine << "\n";
+        for (const BenchResult& res : vResults) {
+            int n = snprintf(sLine, sizeof(sLine), "%-40s%10.2f%8.1f%10.2f%10.2f%7.1f", res.sName.c_str(), res.fMedianNs,
+                res.fMeanNs > 0 ? 100.0 * res.fStdDevNs / res.fMeanNs : 0.0, res.fMinNs, res.OpsPerSecond() / 1e6, 100.0 * res.fHitRate);
+            if (res.fAllocsPerOp >= 0 && n > 0 && n < int(sizeof(sLine)))
+                snprintf(sLine + n, sizeof(sLine) - n, "%11.3g", res.fAllocsPerOp);
+            os << sLine << "\n";
+        }
+    }
+
+    bool SaveCSV(const std::string& sFile) const
+    {
+        std::ofstream f(sFile);
+        if (!f)
+            return false;
+        f << "benchmark,ops,median_ns,min_ns,mean_ns,stddev_ns,ops_per_s,hit_rate,allocs_per_op\n";
+        for (const BenchResult& res : vResults)
+            f << res.sName << "," << res.nOps << "," << res.fMedianNs << "," << res.fMinNs << "," << res.fMeanNs << ","
+                << res.fStdDevNs << "," << res.OpsPerSecond() << "," << res.fHitRate << "," << res.fAllocsPerOp << "\n";
+        return bool(f);
+    }
+
+    // Compares medians against a CSV from SaveCSV and reports each change.
+    // Returns how many benchmarks got more than fTolerance (0.1 = 10%) slower
+    // or now allocate more often, or -1 if the baseline can't be read.
+    // Benchmarks missing from either side are listed but don't count.
+    int Compare(const std::string& sFile, double fTolerance, std::ostream& os) const
+    {
+        std::ifstream f(sFile);
+        if (!f)
+            return -1;
+        std::map<std::string, std::pair<double, double>> mapBase;     // Median ns, allocations per op
+        std::string sLine;
+        std::getline(f, sLine);
+        while (std::getline(f, sLine)) {
+            std::istringstream ss(sLine);
+            std::vector<std::string> vFields;
+            for (std::string sField; std::getline(ss, sField, ','); )
+                vFields.push_back(sField);
+            if (vFields.size() >= 3)
+                mapBase[vFields[0]] = { std::atof(vFields[2].c_str()), vFields.size() >= 9 ? std::atof(vFields[8].c_str()) : -1.0 };
+        }
+
+        int nRegressions = 0;
+        char sOut[160];
+        for (const BenchResult& res : vResults) {
+            auto it = mapBase.find(res.sName);
+            if (it == mapBase.end() || it->second.first <= 0) {
+                os << res.sName << ": not in baseline\n";
+                continue;
+            }
+            auto [fBaseNs, fBaseAllocs] = it->second;
+            double fChange = res.fMedianNs / fBaseNs - 1.0;
+            bool bSlower = fChange > fTolerance;
+            bool bAllocates = fBaseAllocs >= 0 && res.fAllocsPerOp > fBaseAllocs;
+            nRegressions += bSlower || bAllocates;
+            snprintf(sOut, sizeof(sOut), "%-40s%10.2f ->%10.2f ns/op %+7.1f%%%s%s", res.sName.c_str(), fBaseNs, res.fMedianNs,
+                100.0 * fChange, bSlower ? "  REGRESSED" : "", bAllocates ? "  ALLOCATES MORE" : "");
+            os << sOut << "\n";
+            mapBase.erase(it);
+        }
+        for (auto& [sName, fNs] : mapBase)
+            os << sName << ": in baseline only\n";
+        return nRegressions;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+};
+
+// The olc::aabb routines over CombatBoard::Default()'s walls and over hand
+// made cases for the paths the board rarely reaches:
+//   /board     points, rects or movers spread over the arena, tested against
+//              every wall, so mostly misses as in a real tick
+//   /contact   movers next to a wall and heading into it, so mostly hits
+//   /hit, /miss rays aimed at or away from one rect
+//   /parallel  axis-aligned and almost axis-aligned rays, including origins
+//              exactly on the rect's edge lines, where RayVsRect sees inf and
+//              NaN and takes its early outs
+// SweepRects is timed per path the CPU supports, per wall tested, so it can
+// be read against DynamicRectVsRect/board.
+inline void AabbBenchmarks(CombatBench& bench, uint32_t nSeed = 1)
+{
+    using olc::aabb::rect;
+    auto board = CombatBoard::Default();
+    const std::vector<rect>& vWalls = board->vRects;
+    const long long nWalls = (long long)vWalls.size();
+    const olc::vf2d vArena = { float(board->nBoardWidth * board->nSquareSize), float(board->nBoardHeight * board->nSquareSize) };
+    const float dt = CombatSim::fTickTime;
+
+    std::mt19937 rng(nSeed);
+    auto uniform = [&](float a, float b) { return std::uniform_real_distribution<float>(a, b)(rng); };
+    auto inArena = [&]() { return olc::vf2d{ uniform(0, vArena.x), uniform(0, vArena.y) }; };
+
+    constexpr int nSpread = 4096;           // Items tested against every wall
+    constexpr int nSingle = 1 << 16;        // Items tested against one rect
+
+    // Points and tank-sized rects anywhere in the arena
+    std::vector<olc::vf2d> vPoints(nSpread);
+    std::vector<rect> vRects(nSpread);
+    for (int i = 0; i < nSpread; i++) {
+        vPoints[i] = inArena();
+        vRects[i] = { inArena() - olc::vf2d{ 4, 4 }, { 8, 8 }, { 0, 0 } };
+    }
+
+    // Tanks and bullets at game speeds, anywhere in the arena
+    std::vector<rect> vMovers(nSpread);
+    for (int i = 0; i < nSpread; i++) {
+        bool bBullet = i % 2;
+        float fAngle = float(rng() % 16) * 0.125f * 3.14159265f, fSpeed = bBullet ? 100.0f : 6.0f;
+        olc::vf2d vSize = bBullet ? olc::vf2d{ 1, 1 } : olc::vf2d{ 8, 8 };
+        vMovers[i] = { inArena() - vSize / 2, vSize, { fSpeed * std::cos(fAngle), fSpeed * std::sin(fAngle) } };
+    }
+
+    // Movers just outside a wall and closing on it fast enough to touch it this step
+    std::vector<rect> vContacts(nSingle);
+    std::vector<const rect*> vContactWalls(nSingle);
+    for (int i = 0; i < nSingle; i++) {
+        const rect& w = vWalls[rng() % vWalls.size()];
+        olc::vf2d vSize = (i % 2) ? olc::vf2d{ 1, 1 } : olc::vf2d{ 8, 8 };
+        olc::vf2d vTarget = w.pos + olc::vf2d{ uniform(0, w.size.x), uniform(0, w.size.y) };
+        olc::vf2d vPos;
+        switch (rng() % 4) {
+        case 0: vPos = { w.pos.x - vSize.x - uniform(0, 2), vTarget.y - vSize.y / 2 }; break;
+        case 1: vPos = { w.pos.x + w.size.x + uniform(0, 2), vTarget.y - vSize.y / 2 }; break;
+        case 2: vPos = { vTarget.x - vSize.x / 2, w.pos.y - vSize.y - uniform(0, 2) }; break;
+        default: vPos = { vTarget.x - vSize.x / 2, w.pos.y + w.size.y + uniform(0, 2) }; break;
+        }
+        olc::vf2d vToward = vTarget - (vPos + vSize / 2);
+        vContacts[i] = { vPos, vSize, vToward / dt * uniform(1.0f, 1.5f) };
+        vContactWalls[i] = &w;
+    }
+
+    // Rays against one rect: aimed into it, the same rays reversed, and
+    // parallel to an axis with the origin on, beside or in line with an edge
+    const rect target = { { 80, 60 }, { 16, 16 }, { 0, 0 } };
+    std::vector<olc::vf2d> vRayOrigin(nSingle), vRayHit(nSingle), vRayMiss(nSingle), vParOrigin(nSingle), vParDir(nSingle);
+    for (int i = 0; i < nSingle; i++) {
+        olc::vf2d vOrigin;
+        do vOrigin = inArena(); while (olc::aabb::PointVsRect(vOrigin, &target));
+        olc::vf2d vAim = target.pos + olc::vf2d{ uniform(0, target.size.x), uniform(0, target.size.y) };
+        vRayOrigin[i] = vOrigin;
+        vRayHit[i] = (vAim - vOrigin) * uniform(1.0f, 2.0f);
+        vRayMiss[i] = -vRayHit[i];
+
+        float fAlong = uniform(-40, 40), fSign = (rng() % 2) ? 1.0f : -1.0f;
+        float fEdge = (rng() % 2) ? target.pos.y : target.pos.y + target.size.y;
+        switch (rng() % 3) {
+        case 0: vParOrigin[i] = { target.pos.x + fAlong, fEdge }; vParDir[i] = { fSign * 50, 0 }; break;                          // 0 * inf = NaN
+        case 1: vParOrigin[i] = { target.pos.x + fAlong, target.pos.y + uniform(-8, 24) }; vParDir[i] = { fSign * 50, 0 }; break; // +-inf
+        default: vParOrigin[i] = { target.pos.x + fAlong, target.pos.y + uniform(-8, 24) }; vParDir[i] = { fSign * 50, 1e-30f }; break;
+        }
+    }
+
+    bench.Run("PointVsRect/board", nSpread * nWalls, [&]() {
+        long long nHits = 0;
+        for (const olc::vf2d& p : vPoints)
+            for (const rect& w : vWalls)
+                nHits += olc::aabb::PointVsRect(p, &w);
+        return nHits;
+    });
+
+    bench.Run("RectVsRect/board", nSpread * nWalls, [&]() {
+        long long nHits = 0;
+        for (const rect& r : vRects)
+            for (const rect& w : vWalls)
+                nHits += olc::aabb::RectVsRect(&r, &w);
+        return nHits;
+    });
+
+    auto rays = [&](const std::vector<olc::vf2d>& vOrigins, const std::vector<olc::vf2d>& vDirs) {
+        return [&]() {
+            long long nHits = 0;
+            olc::vf2d cp, cn;
+            float t = 0;
+            for (int i = 0; i < nSingle; i++)
+                nHits += olc::aabb::RayVsRect(vOrigins[i], vDirs[i], &target, cp, cn, t);
+            return nHits;
+        };
+    };
+    bench.Run("RayVsRect/hit", nSingle, rays(vRayOrigin, vRayHit));
+    bench.Run("RayVsRect/miss", nSingle, rays(vRayOrigin, vRayMiss));
+    bench.Run("RayVsRect/parallel", nSingle, rays(vParOrigin, vParDir));
+
+    bench.Run("DynamicRectVsRect/board", nSpread * nWalls, [&]() {
+        long long nHits = 0;
+        olc::vf2d cp, cn;
+        float t = 0;
+        for (const rect& m : vMovers)
+            for (const rect& w : vWalls)
+                nHits += olc::aabb::DynamicRectVsRect(&m, dt, w, cp, cn, t);
+        return nHits;
+    });
+
+    bench.Run("DynamicRectVsRect/contact", nSingle, [&]() {
+        long long nHits = 0;
+        olc::vf2d cp, cn;
+        float t = 0;
+        for (int i = 0; i < nSingle; i++)
+            nHits += olc::aabb::DynamicRectVsRect(&vContacts[i], dt, *vContactWalls[i], cp, cn, t);
+        return nHits;
+    });
+
+    // Resolve changes the mover, so each op starts from a copy
+    bench.Run("ResolveDynamicRectVsRect/board", nSpread * nWalls, [&]() {
+        long long nHits = 0;
+        for (const rect& m : vMovers) {
+            rect r = m;
+            for (const rect& w : vWalls)
+                nHits += olc::aabb::ResolveDynamicRectVsRect(&r, dt, &w);
+        }
+        return nHits;
+    });
+
+    bench.Run("ResolveDynamicRectVsRect/contact", nSingle, [&]() {
+        long long nHits = 0;
+        for (int i = 0; i < nSingle; i++) {
+            rect r = vContacts[i];
+            nHits += olc::aabb::ResolveDynamicRectVsRect(&r, dt, vContactWalls[i]);
+        }
+        return nHits;
+    });
+
+    std::vector<std::pair<int, float>> vHits(vWalls.size());
+    auto sweep = [&](auto fnSweep) {
+        return [&, fnSweep]() {
+            long long nHits = 0;
+            for (const rect& m : vMovers)
+                nHits += fnSweep(&m, dt, board->wallSoA, nullptr, 0, board->wallSoA.nCount, vHits.data());
+            return nHits;
+        };
+    };
+    bench.Run("SweepRects/scalar/board", nSpread * nWalls, sweep(olc::aabb::SweepRectsScalar));
+#if defined(OLC_AABB_X86)
+    olc::aabb::sweep_path best = olc::aabb::DetectSweepPath();
+    if (best >= olc::aabb::sweep_path::sse2)
+        bench.Run("SweepRects/sse2/board", nSpread * nWalls, sweep(olc::aabb::SweepRectsSSE2));
+    if (best >= olc::aabb::sweep_path::avx2)
+        bench.Run("SweepRects/avx2/board", nSpread * nWalls, sweep(olc::aabb::SweepRectsAVX2));
+#endif
+}
+
+// A match to time CombatSim::Tick over, recorded with its inputs
+struct TickScenario
+{
+    std::string sName;
+    CombatReplay replay;
+};
+
+// Records nTicks of a match on board, with fnInput(sim, in, in2) choosing
+// each tick's inputs from the state the sim is in
+template<typename F>
+CombatReplay RecordScenario(std::shared_ptr<const CombatBoard> board, const CombatRules& rules, int nTicks, F&& fnInput)
+{
+    CombatSim sim;
+    sim.Create(std::move(board), rules);
+    CombatReplay replay;
+    replay.Begin(sim);
+    for (int t = 0; t < nTicks; t++) {
+        CombatInput in, in2;
+        fnInput(sim, in, in2);
+        sim.Tick(in, in2);
+        replay.Record(in, in2);
+    }
+    replay.Finish(sim);
+    return replay;
+}
+
+// The fixed corpus, a full match each, covering the tick's main paths:
+//   idle           nobody at the keys; the AI roams and fires on its own
+//   walls          both tanks driving flat out, turning now and then, so
+//                  they spend most ticks pressed against a wall
+//   rapid-fire     both tanks turning on the spot and firing every tick
+//   spin-knockback both tanks hunting each other, so hits, spins and
+//                  knockback into walls come up all the time
+//   teams-16       eight a side with four shots each, the AI firing every
+//                  second and the player roaming
+//   flow-16, path-16  the same, with the AI steering by FlowField and by
+//                  PathService
+//   sight-16       the same, with the AI holding fire until it has a shot
+//   bullet-storm   32 a side with eight shots each, the AI firing every
+//                  second, so the bullet pool stays close to full and firing
+//                  keeps recycling
+// Recorded from scripts rather than kept as files, so a change to the sim
+// changes the scenarios with it instead of making them diverge.
+inline std::vector<TickScenario> TickScenarios()
+{
+    auto board = CombatBoard::Default();
+    CombatRules onePlayer, twoPlayer;
+    twoPlayer.bTwoPlayer = true;
+    const int nTicks = CombatSim::nMatchTicks;
+
+    // Drives to each waypoint in turn, then turns towards the other tank,
+    // closes in while lined up and fires every few shots' worth of range
+    struct Hunter
+    {
+        std::vector<olc::vf2d> vWaypoints;
+        size_t nNext = 0;
+
+        static int Turn(int nHeading, const olc::vf2d& d)
+        {
+            int nWant = int(std::lround(std::atan2(d.y, d.x) / (0.125 * PI)) + 16) % 16;
+            return (nWant - nHeading + 16) % 16;
+        }
+
+        void Next(const CombatSim& sim, int nMe, int nThem, CombatInput& in)
+        {
+            const olc::vf2d& vMe = sim.tanks.aPos[nMe];
+            while (nNext < vWaypoints.size() && (vWaypoints[nNext] - vMe).mag2() < 4)
+                nNext++;
+            bool bHunting = nNext == vWaypoints.size();
+            olc::vf2d d = (bHunting ? sim.tanks.aPos[nThem] : vWaypoints[nNext]) - vMe;
+            int nTurn = Turn(sim.tanks.aHeading[nMe], d);
+            int nTick = sim.nTick + 5 * nMe;
+            in.bRight = nTurn > 0 && nTurn < 8;
+            in.bLeft = nTurn >= 8;
+            in.bUp = nTurn == 0 && (!bHunting || d.mag2() > 32 * 32);
+            in.bFire = bHunting && nTurn == 0 && nTick % 45 == 0;
+        }
+    };
+
+    std::vector<TickScenario> vScenarios;
+    vScenarios.push_back({ "idle", RecordScenario(board, onePlayer, nTicks, [](const CombatSim&, CombatInput&, CombatInput&) {}) });
+    vScenarios.push_back({ "walls", RecordScenario(board, twoPlayer, nTicks, [](const CombatSim& sim, CombatInput& in, CombatInput& in2) {
+        in.bUp = in2.bUp = true;
+        in.bLeft = (sim.nTick % 120) < 10;
+        in2.bRight = (sim.nTick % 150) < 10;
+    }) });
+    vScenarios.push_back({ "rapid-fire", RecordScenario(board, twoPlayer, nTicks, [](const CombatSim& sim, CombatInput& in, CombatInput& in2) {
+        in.bLeft = in2.bRight = (sim.nTick % 4) == 0;
+        in.bFire = in2.bFire = true;
+    }) });
+    // Out to the open lane along y = 104 first, where nothing stands between them
+    std::array<Hunter, 2> hunters = { Hunter{ { { 100, 68 }, { 100, 104 } } }, Hunter{ { { 168, 104 } } } };
+    vScenarios.push_back({ "spin-knockback", RecordScenario(board, twoPlayer, nTicks, [&](const CombatSim& sim, CombatInput& in, CombatInput& in2) {
+        hunters[0].Next(sim, 0, 1, in);
+        hunters[1].Next(sim, 1, 0, in2);
+    }) });
+    CombatRules teams;
+    teams.nTanks = 16;
+    teams.nBulletsPerTank = 4;
+    teams.fAIFireDelay = 1;
+    // The same player for every AI, so the scenarios differ only in the AI
+    auto teamsInput = [](const CombatSim& sim, CombatInput& in, CombatInput&) {
+        in.bLeft = (sim.nTick % 90) < 15;
+        in.bUp = true;
+        in.bFire = (sim.nTick % 20) == 0;
+    };
+    CombatRules flow = teams, path = teams, sight = teams;
+    flow.bFlowAI = true;
+    path.bPathAI = true;
+    sight.bSightAI = true;
+    const std::pair<const char*, const CombatRules*> aTeams[] = { { "teams-16", &teams }, { "flow-16", &flow }, { "path-16", &path }, { "sight-16", &sight } };
+    for (const auto& t : aTeams)
+        vScenarios.push_back({ t.first, RecordScenario(board, *t.second, nTicks, teamsInput) });
+    CombatRules storm;
+    storm.nTanks = CombatState::nMaxTanks;
+    storm.nBulletsPerTank = 8;
+    storm.fAIFireDelay = 1;
+    vScenarios.push_back({ "bullet-storm", RecordScenario(board, storm, nTicks, [](const CombatSim& sim, CombatInput& in, CombatInput&) {
+        in.bLeft = (sim.nTick % 60) < 10;
+        in.bFire = (sim.nTick % 6) == 0;
+    }) });
+    return vScenarios;
+}
+
+// Whole ticks, one op each, replaying every scenario from a fresh match; hits
+// are bullets hitting a tank. The sim is created once per pass, as a match
+// would be, so with an allocation counter set allocs/op shows any tick that
+// allocates. A scenario that doesn't end where it was recorded is reported,
+// since its timings then describe a different match.
+inline void TickBenchmarks(CombatBench& bench, const std::vector<TickScenario>& vScenarios, std::ostream& os)
+{
+    auto board = CombatBoard::Default();
+    CombatSim sim;
+    for (const TickScenario& sc : vScenarios) {
+        const CombatReplay& replay = sc.replay;
+        bench.Run("tick/" + sc.sName, replay.Ticks(), [&]() {
+            sim.Create(board, replay.rules);
+            for (int t = 0; t < replay.Ticks(); t++)
+                sim.Tick(replay.Input(t), replay.Input2(t));
+            return (long long)(sim.TeamTotal(sim.tanks.aHits, 0) + sim.TeamTotal(sim.tanks.aHits, 1));
+        });
+        if (replay.nFinalHash != 0 && sim.StateHash() != replay.nFinalHash)
+            os << "tick/" << sc.sName << ": ended in a different state than recorded\n";
+    }
+}
+
+// PathService over CombatBoard::Default(), one op per query, between cells
+// drawn from the open floor; hits are queries answered from the cache:
+//   /search    the cache cleared before every batch, so every query searches
+//   /cached    the same batches again, answered from the cache unless two
+//              later keys have since filled the key's set
+//   /threads-N the searching batches over N threads, if nThreads > 1
+// Batches are nBatch queries, as a tick with that many AI tanks would ask.
+// The searches' latency over the last run is printed after.
+inline void PathBenchmarks(CombatBench& bench, int nThreads, std::ostream& os, uint32_t nSeed = 1)
+{
+    constexpr int nBatch = 32, nBatches = 16;
+    auto board = CombatBoard::Default();
+    int nTankTiles = CombatBoard::FlowTiles(board->nSquareSize);
+    PathService paths;
+    paths.Build(board->sBoard, board->nBoardWidth, board->nBoardHeight, nTankTiles, nBatch, board->nHash);
+
+    std::vector<int> vFloor;
+    for (int c = 0; c < int(paths.vOpen.size()); c++)
+        if (paths.vOpen[c])
+            vFloor.push_back(c);
+    std::mt19937 rng(nSeed);
+    std::vector<PathService::Query> vQueries(nBatch * nBatches);
+    for (PathService::Query& q : vQueries)
+        q = { vFloor[rng() % vFloor.size()], vFloor[rng() % vFloor.size()] };
+
+    auto pass = [&](bool bClear) {
+        return [&, bClear]() {
+            long long nHits = 0;
+            for (int b = 0; b < nBatches; b++) {
+                if (bClear)
+                    paths.ClearCache();
+                paths.Solve(&vQueries[size_t(b) * nBatch], nBatch);
+                for (int q = 0; q < nBatch; q++)
+                    nHits += vQueries[size_t(b) * nBatch + q].bCached;
+            }
+            return nHits;
+        };
+    };
+    auto report = [&](const std::string& sName) {
+        PathService::Stats st = paths.GetStats();
+        char sLine[160];
+        snprintf(sLine, sizeof(sLine), "%-40s%.1f cells expanded, %.2f us mean, %.2f p99, %.2f max per search", sName.c_str(),
+            st.nSearches ? double(st.nExpanded) / double(st.nSearches) : 0.0, st.fMeanUs, st.fP99Us, st.fMaxUs);
+        os << sLine << "\n";
+        paths.ResetStats();
+    };
+
+    bench.Run("path/search", nBatch * nBatches, pass(true));
+    report("path/search");
+    bench.Run("path/cached", nBatch * nBatches, pass(false));
+    if (nThreads > 1) {
+        paths.Start(nThreads);
+        std::string sName = "path/threads-" + std::to_string(nThreads);
+        bench.Run(sName, nBatch * nBatches, pass(true));
+        report(sName);
+        paths.Stop();
+    }
+}
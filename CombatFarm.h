@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "CombatSim.h"
+
+// One match for the farm to play
+struct CombatMatchSpec
+{
+    uint32_t nSeed = 1;                         // Seeds the player's bot
+    std::shared_ptr<const CombatBoard> board;   // Null plays CombatBoard::Default()
+    CombatRules rules;
+};
+
+struct CombatMatchResult
+{
+    int nTicks = 0;
+    std::array<int, 2> nScore = {}, nShots = {}, nHits = {};   // Red team (the player's), blue team
+    uint64_t nHash = 0;                                         // CombatSim::StateHash() at the end
+};
+
+// Totals over a farm run
+struct CombatFarmReport
+{
+    int nMatches = 0;
+    int nThreads = 0;
+    long long nTicks = 0;
+    int nMinTicks = 0, nMaxTicks = 0;
+    std::array<long long, 2> nScore = {}, nShots = {}, nHits = {};
+    uint64_t nHash = 0;                 // Folded in match order, so it doesn't depend on scheduling
+    double fSeconds = 0;
+    std::vector<int> vMatchesPerThread; // Shows how well stealing balanced the load
+    std::vector<CombatMatchResult> vResults;
+
+    double MatchesPerSecond() const { return fSeconds > 0 ? nMatches / fSeconds : 0; }
+    double TicksPerSecond() const { return fSeconds > 0 ? nTicks / fSeconds : 0; }
+};
+
+// Plays independent matches on a pool of threads. Every worker starts with an
+// equal slice of the match indices and plays them front to back; a worker that
+// runs dry steals the back half of another worker's slice. A slice is one
+// 64-bit word (begin | end << 32) changed only by compare-exchange, so neither
+// playing nor stealing takes a lock, and each worker reuses one CombatSim.
+class CombatFarm
+{
+public:
+    // fnPlay(spec, sim) plays sim, already Create()d from spec, until MatchOver()
+    template<typename F>
+    static CombatFarmReport Run(const std::vector<CombatMatchSpec>& vSpecs, int nThreads, F&& fnPlay)
+    {
+        CombatFarmReport report;
+        report.nMatches = int(vSpecs.size());
+        report.nThreads = nThreads = std::max(1, std::min(nThreads, std::max(1, report.nMatches)));
+        report.vMatchesPerThread.assign(nThreads, 0);
+        report.vResults.resize(vSpecs.size());
+
+        std::vector<Slice> vSlices(nThreads);
+        for (int t = 0; t < nThreads; t++)
+            vSlices[t].range = Pack(uint32_t(int64_t(report.nMatches) * t / nThreads), uint32_t(int64_t(report.nMatches) * (t + 1) / nThreads));
+
+        auto worker = [&](int t) {
+            CombatSim sim;
+            int nPlayed = 0;
+            uint32_t i;
+            while (Next(vSlices, t, i)) {
+                const CombatMatchSpec& spec = vSpecs[i];
+                sim.Create(spec.board ? spec.board : CombatBoard::Default(), spec.rules);
+                fnPlay(spec, sim);
+
+                CombatMatchResult& res = report.vResults[i];
+                res.nTicks = sim.nTick;
+                for (int k = 0; k < 2; k++) {
+                    res.nScore[k] = sim.TeamTotal(sim.tanks.aScore, k);
+                    res.nShots[k] = sim.TeamTotal(sim.tanks.aShots, k);
+                    res.nHits[k] = sim.TeamTotal(sim.tanks.aHits, k);
+                }
+                res.nHash = sim.StateHash();
+                nPlayed++;
+            }
+            report.vMatchesPerThread[t] = nPlayed;
+        };
+
+        auto tp1 = std::chrono::steady_clock::now();
+        std::vector<std::thread> vThreads;
+        for (int t = 1; t < nThreads; t++)
+            vThreads.emplace_back(worker, t);
+        worker(0);
+        for (auto& th : vThreads)
+            th.join();
+        auto tp2 = std::chrono::steady_clock::now();
+        report.fSeconds = std::chrono::duration<double>(tp2 - tp1).count();
+
+        report.nMinTicks = report.vResults.empty() ? 0 : report.vResults[0].nTicks;
+        for (const CombatMatchResult& res : report.vResults) {
+            report.nTicks += res.nTicks;
+            report.nMinTicks = std::min(report.nMinTicks, res.nTicks);
+            report.nMaxTicks = std::max(report.nMaxTicks, res.nTicks);
+            for (int k = 0; k < 2; k++) {
+                report.nScore[k] += res.nScore[k];
+                report.nShots[k] += res.nShots[k];
+                report.nHits[k] += res.nHits[k];
+            }
+            report.nHash = report.nHash * 1099511628211ull ^ res.nHash;
+        }
+        return report;
+    }
+
+private:
+    // Unplayed match indices [begin, end) of one worker, on its own cache line
+    struct alignas(64) Slice
+    {
+        std::atomic<uint64_t> range{ 0 };
+    };
+
+    static uint64_t Pack(uint32_t nBegin, uint32_t nEnd) { return uint64_t(nBegin) | (uint64_t(nEnd) << 32); }
+
+    // Claims the next match for worker t, stealing if its own slice is empty.
+    // An index leaves a slice only by being claimed or stolen, so a slice
+    // never returns to an earlier value and compare-exchange can't suffer ABA.
+    static bool Next(std::vector<Slice>& vSlices, int t, uint32_t& i)
+    {
+        for (;;) {
+            // Own slice: take from the front
+            uint64_t r = vSlices[t].range.load(std::memory_order_relaxed);
+            while (uint32_t(r) < uint32_t(r >> 32)) {
+                if (vSlices[t].range.compare_exchange_weak(r, r + 1, std::memory_order_relaxed)) {
+                    i = uint32_t(r);
+                    return true;
+                }
+            }
+
+            // Empty: take the back half of the first victim that has work
+            bool bStole = false;
+            int nSlices = int(vSlices.size());
+            for (int v = 1; v < nSlices && !bStole; v++) {
+                Slice& victim = vSlices[(t + v) % nSlices];
+                uint64_t rv = victim.range.load(std::memory_order_relaxed);
+                for (;;) {
+                    uint32_t nBegin = uint32_t(rv), nEnd = uint32_t(rv >> 32);
+                    if (nBegin >= nEnd)
+                        break;
+                    uint32_t nMid = nEnd - (nEnd - nBegin + 1) / 2;
+                    if (victim.range.compare_exchange_weak(rv, Pack(nBegin, nMid), std::memory_order_relaxed)) {
+                        vSlices[t].range.store(Pack(nMid, nEnd), std::memory_order_relaxed);
+                        bStole = true;
+                        break;
+                    }
+                }
+            }
+            if (!bStole)
+                return false;
+        }
+    }
+};
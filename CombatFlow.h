@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Distances over a board's tiles to the nearest of a set of goal cells, so
+// any number of AI tanks steer by looking at the cell they stand on and
+// stepping downhill. A cell is a place a tank's top left corner can sit, on
+// the tile grid, with the whole tank clear of wall tiles. Distances are
+// four-connected; a step may also go diagonally where both cells beside the
+// diagonal are open, so following the field never cuts a corner.
+//
+// Build() once per board. Update() with the goals every tick. When only a
+// few goals have changed cell, as when tanks are driving about, it repairs
+// the field where those goals were or now are and leaves the rest alone: the
+// cells that only a goal that has gone led to are cleared and filled in
+// again from around them, and a new goal's distances spread only as far as
+// it is nearer than the others. Otherwise it searches the whole board again.
+// Either way the distances are exact, so the field is a function of the goal
+// cells alone and a rolled back sim gets the same one. Nothing allocates
+// after Build().
+class FlowField
+{
+public:
+    static constexpr uint32_t nUnreached = 0xFFFFFFFF;
+
+    int nWidth = 0, nHeight = 0;
+    std::vector<uint8_t> vOpen;         // 1 where a tank fits
+    std::vector<uint32_t> vDist;        // Steps to the nearest goal, or nUnreached; a step per cell at most, so never saturating
+    int nSearches = 0;                  // Whole board searches since Build()
+    int nRepairs = 0;                   // Updates that repaired the field instead
+    long long nVisited = 0;             // Cells either took off a queue, since Build()
+
+    void Build(const std::wstring& sBoard, int nBoardWidth, int nBoardHeight, int nTankTiles, int nMaxGoals)
+    {
+        nWidth = nBoardWidth;
+        nHeight = nBoardHeight;
+        OpenCells(sBoard, nWidth, nHeight, nTankTiles, vOpen);
+        vDist.assign(vOpen.size(), nUnreached);
+        vQueue.assign(vOpen.size(), 0);
+        vSeeds.assign(vOpen.size(), 0);
+        vColumn.resize(vOpen.size());
+        for (size_t i = 0; i < vColumn.size(); i++)
+            vColumn[i] = uint16_t(i % nWidth);
+        vGoals.clear();
+        vGoals.reserve(nMaxGoals);
+        vNewGoals.clear();
+        vNewGoals.reserve(nMaxGoals);
+#if defined(_DEBUG)
+        vCheck.assign(vOpen.size(), 0);
+#endif
+        nSearches = nRepairs = 0;
+        nVisited = 0;
+    }
+
+    // vOpen for a board: 1 where nTankTiles by nTankTiles tiles from the cell are clear of walls
+    static void OpenCells(const std::wstring& sBoard, int nBoardWidth, int nBoardHeight, int nTankTiles, std::vector<uint8_t>& vOpen)
+    {
+        vOpen.assign(size_t(nBoardWidth) * nBoardHeight, 0);
+        for (int y = 0; y + nTankTiles <= nBoardHeight; y++)
+            for (int x = 0; x + nTankTiles <= nBoardWidth; x++) {
+                bool bOpen = true;
+                for (int j = 0; j < nTankTiles && bOpen; j++)
+                    for (int i = 0; i < nTankTiles && bOpen; i++)
+                        bOpen = sBoard[size_t(y + j) * nBoardWidth + x + i] != L'#';
+                vOpen[size_t(y) * nBoardWidth + x] = bOpen;
+            }
+    }
+
+    // Goals are cells, y * nWidth + x; they needn't be open, and off the board they're ignored
+    void Update(const int* pGoals, int nGoals)
+    {
+        vNewGoals.clear();
+        for (int g = 0; g < nGoals; g++)
+            if (pGoals[g] >= 0 && pGoals[g] < int(vDist.size()))
+                vNewGoals.push_back(pGoals[g]);
+        std::sort(vNewGoals.begin(), vNewGoals.end());
+        vNewGoals.erase(std::unique(vNewGoals.begin(), vNewGoals.end()), vNewGoals.end());
+        if (nSearches > 0 && vNewGoals == vGoals)
+            return;
+
+        // Clearing and refilling a lost goal's cells costs about what a whole
+        // search does once more than half of them go
+        int nGone = 0;
+        for (int g : vGoals)
+            nGone += !std::binary_search(vNewGoals.begin(), vNewGoals.end(), g);
+        if (nSearches == 0 || 2 * nGone > int(vGoals.size()))
+            Search(vNewGoals);
+        else
+            Repair();
+        vGoals.swap(vNewGoals);
+#if defined(_DEBUG)
+        // Debug builds hold every repair to a search from scratch
+        vCheck.swap(vDist);
+        long long nWas = nVisited;
+        Search(vGoals);
+        nSearches--;
+        nVisited = nWas;
+        assert(vCheck == vDist && "FlowField::Repair() differs from a search");
+#endif
+    }
+
+    // Heading 0-15 one step closer to a goal from nCell, going to the lowest
+    // neighbour and diagonally only past two open sides; -1 on a goal or
+    // when cut off. Worked out here rather than for every cell in Search(),
+    // as only the cells tanks stand on are ever asked about
+    int Step(int nCell) const
+    {
+        if (nCell < 0 || nCell >= int(vDist.size()) || vDist[nCell] == 0 || vDist[nCell] == nUnreached)
+            return -1;
+        uint32_t nBest = vDist[nCell];
+        int nStep = -1;
+        for (int m = 0; m < 8; m++) {
+            if (!Inside(nCell, m))
+                continue;
+            if ((m & 1) && (!vOpen[Offset(nCell, m - 1)] || !vOpen[Offset(nCell, (m + 1) & 7)]))
+                continue;
+            uint32_t d = vDist[Offset(nCell, m)];
+            if (d < nBest) {
+                nBest = d;
+                nStep = 2 * m;
+            }
+        }
+        return nStep;
+    }
+
+    // The cell a heading from Step() leads to
+    int Next(int nCell, int nHeading) const { return Offset(nCell, nHeading / 2); }
+
+private:
+    // The eight ways to step, as headings 0, 2, .. 14 go: y is down the board
+    static constexpr int aMove[8][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } };
+
+    std::vector<int> vGoals, vNewGoals;     // Sorted, without repeats
+    std::vector<int> vQueue;
+    std::vector<uint64_t> vSeeds;           // Distance << 32 | cell, for Repair()
+    std::vector<uint16_t> vColumn;          // x of every cell, so the search never divides
+#if defined(_DEBUG)
+    std::vector<uint32_t> vCheck;
+#endif
+
+    int Offset(int nCell, int m) const { return nCell + aMove[m][0] + aMove[m][1] * nWidth; }
+
+    // A step is on the board if its column is and its cell is
+    bool Inside(int nCell, int m) const
+    {
+        int nx = vColumn[nCell] + aMove[m][0];
+        return nx >= 0 && nx < nWidth && unsigned(Offset(nCell, m)) < unsigned(vDist.size());
+    }
+
+    // Multi-source breadth first, four-connected, from the goals
+    void Search(const std::vector<int>& vTo)
+    {
+        nSearches++;
+        std::fill(vDist.begin(), vDist.end(), nUnreached);
+        int nTail = 0;
+        for (int nGoal : vTo) {
+            vDist[nGoal] = 0;
+            vQueue[nTail++] = nGoal;
+        }
+        Spread(nullptr, 0, nTail);
+    }
+
+    // From vGoals to vNewGoals, touching only the cells whose distance changes
+    // and those beside them. First every cell that only a lost goal led to
+    // is cleared: a cell whose distance is one more than a cleared cell's is
+    // cleared in turn unless some other neighbour is also one nearer. The
+    // queue goes out from the lost goals a distance at a time, so every
+    // cleared cell nearer than a cell has been cleared by the time it's
+    // looked at. Each cleared cell then takes one more than its nearest
+    // uncleared neighbour, the new goals take 0, and those spread in order
+    // of distance, lowering any cell they're nearer than.
+    void Repair()
+    {
+        nRepairs++;
+        int nTail = 0;
+        for (int g : vGoals)
+            if (!std::binary_search(vNewGoals.begin(), vNewGoals.end(), g)) {
+                vDist[g] = nUnreached;
+                vQueue[nTail++] = g;
+            }
+        // Cleared cells keep their old distance in vSeeds until refilled
+        for (int i = 0; i < nTail; i++)
+            vSeeds[i] = uint64_t(vQueue[i]);
+        for (int nHead = 0; nHead < nTail; nHead++) {
+            int c = vQueue[nHead];
+            uint32_t d = uint32_t(vSeeds[nHead] >> 32) + 1;
+            nVisited++;
+            for (int m = 0; m < 8; m += 2) {
+                int n = Offset(c, m);
+                if (!Inside(c, m) || vDist[n] != d)
+                    continue;
+                bool bHeld = false;
+                for (int k = 0; k < 8 && !bHeld; k += 2)
+                    bHeld = Inside(n, k) && vDist[Offset(n, k)] == d - 1;
+                if (bHeld)
+                    continue;
+                vDist[n] = nUnreached;
+                vSeeds[nTail] = uint64_t(d) << 32 | uint32_t(n);
+                vQueue[nTail++] = n;
+            }
+        }
+
+        // Refill from the edge of what was cleared, and lower from new goals
+        int nSeeds = 0;
+        for (int i = 0; i < nTail; i++) {
+            int c = vQueue[i];
+            uint32_t nBest = nUnreached;
+            if (vOpen[c])
+                for (int m = 0; m < 8; m += 2)
+                    if (Inside(c, m) && vDist[Offset(c, m)] != nUnreached)
+                        nBest = std::min(nBest, vDist[Offset(c, m)] + 1);
+            if (nBest != nUnreached)
+                vSeeds[nSeeds++] = uint64_t(nBest) << 32 | uint32_t(c);
+        }
+        for (int g : vNewGoals)
+            if (vDist[g] != 0)
+                vSeeds[nSeeds++] = uint32_t(g);
+        std::sort(vSeeds.begin(), vSeeds.begin() + nSeeds);
+        for (int i = 0; i < nSeeds; i++) {
+            int c = int(uint32_t(vSeeds[i]));
+            vDist[c] = std::min(vDist[c], uint32_t(vSeeds[i] >> 32));
+        }
+        Spread(vSeeds.data(), nSeeds, 0);
+    }
+
+    // Breadth first from the cells in vQueue[0, nTail) and, merged in order
+    // of distance, those in pSeeds, which is sorted; a seed some other cell
+    // has since brought nearer is passed over
+    void Spread(const uint64_t* pSeeds, int nSeeds, int nTail)
+    {
+        int nHead = 0, nSeed = 0;
+        for (;;) {
+            int c;
+            if (nSeed < nSeeds && (nHead == nTail || uint32_t(pSeeds[nSeed] >> 32) <= vDist[vQueue[nHead]])) {
+                c = int(uint32_t(pSeeds[nSeed]));
+                if (vDist[c] != uint32_t(pSeeds[nSeed++] >> 32))
+                    continue;
+            }
+            else if (nHead < nTail)
+                c = vQueue[nHead++];
+            else
+                break;
+            nVisited++;
+            uint32_t d = vDist[c] + 1;
+            for (int m = 0; m < 8; m += 2) {
+                int n = Offset(c, m);
+                if (Inside(c, m) && vOpen[n] && vDist[n] > d) {
+                    vDist[n] = d;
+                    vQueue[nTail++] = n;
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "CombatSim.h"
+
+// Seeded boards in the style of the original: a border, a few blocks placed
+// in one quarter of the playfield and mirrored into the other three, and a
+// spawn for each team on the horizontal centre line, one the mirror of the
+// other. A board only counts if Validate() passes, so Generate() keeps
+// drawing from the seed until one does.
+//
+// Generation and validation work on PackedBoard, one 64-bit word of walls
+// per row, so a flood fill step moves a whole row at once; only a board
+// that is actually wanted gets Compile()d into a CombatBoard. Boards are at
+// most 64 tiles wide.
+struct CombatGenParams
+{
+    int nWidth = 47, nHeight = 34, nSquareSize = 4;    // The original's
+    int nTop = 3;               // Rows above the playfield, kept clear for the score
+    int nBlocks = 6;            // Blocks per quarter, before mirroring
+    int nMaxBlock = 4;          // Longest block side, in tiles
+    int nMinSight = 8;          // Open tiles a spawn must see ahead, and to one side
+    float fMinReach = 0.75f;    // Share of the open floor a tank must be able to reach
+};
+
+struct PackedBoard
+{
+    static constexpr int nMaxHeight = 64;
+
+    int nWidth = 0, nHeight = 0;
+    std::array<uint64_t, nMaxHeight> aWalls = {};   // Bit x of row y is tile (x, y)
+    std::array<olc::vi2d, 2> aSpawns;               // Red then blue, top left tile
+
+    bool Wall(int x, int y) const { return (aWalls[y] >> x) & 1; }
+    void Set(int x, int y) { aWalls[y] |= uint64_t(1) << x; }
+    void Clear(int x, int y) { aWalls[y] &= ~(uint64_t(1) << x); }
+};
+
+class CombatBoardGen
+{
+public:
+    static constexpr int nMaxAttempts = 256;
+
+    // Draws boards from nSeed until one validates, trying at most nMaxAttempts;
+    // the same seed and params always give the same board. Returns the
+    // attempts it took, or 0 if none validated.
+    static int Generate(uint64_t nSeed, const CombatGenParams& params, PackedBoard& board)
+    {
+        uint64_t nState = nSeed;
+        for (int nAttempt = 1; nAttempt <= nMaxAttempts; nAttempt++) {
+            Draw(nState, params, board);
+            if (Validate(board, params))
+                return nAttempt;
+        }
+        return 0;
+    }
+
+    // Both spawns' cells are open and joined, four-connected, in the cells
+    // the AI steers by (CombatBoard::FlowTiles() on a side), so flow and path
+    // AI can drive from either to the other; a tank can reach at least
+    // fMinReach of those cells; and neither spawn starts tucked behind a
+    // wall: each sees nMinSight open tiles straight ahead and up or down
+    static bool Validate(const PackedBoard& board, const CombatGenParams& params)
+    {
+        int k = TankTiles(params);
+        std::array<uint64_t, PackedBoard::nMaxHeight> aFree, aReach = {};
+        FreeSpots(board, CombatBoard::FlowTiles(params.nSquareSize), aFree);
+        for (const olc::vi2d& s : board.aSpawns)
+            if (!((aFree[s.y] >> s.x) & 1))
+                return false;
+
+        aReach[board.aSpawns[0].y] = uint64_t(1) << board.aSpawns[0].x;
+        FloodFill(aFree, board.nHeight, aReach);
+        const olc::vi2d& b = board.aSpawns[1];
+        if (!((aReach[b.y] >> b.x) & 1))
+            return false;
+
+        int nFree = 0, nReach = 0;
+        for (int y = 0; y < board.nHeight; y++) {
+            nFree += PopCount(aFree[y]);
+            nReach += PopCount(aReach[y]);
+        }
+        if (nReach < params.fMinReach * nFree)
+            return false;
+
+        for (int t = 0; t < 2; t++) {
+            olc::vi2d s = board.aSpawns[t];
+            int nAhead = t == 0 ? 1 : -1;
+            if (Sight(board, s, k, { nAhead, 0 }, params.nMinSight) < params.nMinSight)
+                return false;
+            if (Sight(board, s, k, { 0, -1 }, params.nMinSight) < params.nMinSight && Sight(board, s, k, { 0, 1 }, params.nMinSight) < params.nMinSight)
+                return false;
+        }
+        return true;
+    }
+
+    static std::shared_ptr<const CombatBoard> Compile(const PackedBoard& board, const CombatGenParams& params)
+    {
+        std::wstring sBoard(size_t(board.nWidth) * board.nHeight, L'.');
+        for (int y = 0; y < board.nHeight; y++)
+            for (int x = 0; x < board.nWidth; x++)
+                if (board.Wall(x, y))
+                    sBoard[size_t(y) * board.nWidth + x] = L'#';
+        CombatBoard::Spawns vSpawns;
+        for (int t = 0; t < 2; t++)
+            vSpawns[t].push_back(olc::vf2d(board.aSpawns[t] * params.nSquareSize));
+        return CombatBoard::Compile(sBoard, board.nWidth, board.nHeight, params.nSquareSize, vSpawns);
+    }
+
+    // Tiles a tank covers each way, lined up on the grid
+    static int TankTiles(const CombatGenParams& params) { return (int(CombatState::vTankSize.x) + params.nSquareSize - 1) / params.nSquareSize; }
+
+private:
+    // splitmix64
+    static uint64_t Next(uint64_t& nState)
+    {
+        uint64_t z = (nState += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    static int PopCount(uint64_t n)
+    {
+        n = n - ((n >> 1) & 0x5555555555555555ull);
+        n = (n & 0x3333333333333333ull) + ((n >> 2) & 0x3333333333333333ull);
+        n = (n + (n >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+        return int((n * 0x0101010101010101ull) >> 56);
+    }
+
+    static void Draw(uint64_t& nState, const CombatGenParams& p, PackedBoard& board)
+    {
+        assert(p.nWidth >= 8 && p.nWidth <= 64 && p.nHeight - p.nTop >= 8 && p.nHeight <= PackedBoard::nMaxHeight && "Unsupported board size");
+        board.nWidth = p.nWidth;
+        board.nHeight = p.nHeight;
+        board.aWalls = {};
+        int nBottom = p.nHeight - 1;
+        uint64_t nRow = (p.nWidth == 64) ? ~uint64_t(0) : (uint64_t(1) << p.nWidth) - 1;
+        board.aWalls[p.nTop] = board.aWalls[nBottom] = nRow;
+        for (int y = p.nTop + 1; y < nBottom; y++)
+            board.aWalls[y] = 1 | (uint64_t(1) << (p.nWidth - 1));
+
+        // Blocks anywhere in the top left quarter, centre lines included, each mirrored three ways
+        int nHalfW = (p.nWidth + 1) / 2, nHalfH = (p.nHeight - p.nTop + 1) / 2;
+        for (int i = 0; i < p.nBlocks; i++) {
+            uint64_t r = Next(nState);
+            int w = 1 + int(r % p.nMaxBlock), h = 1 + int((r >> 8) % p.nMaxBlock);
+            int x0 = 1 + int((r >> 16) % (nHalfW - 1)), y0 = p.nTop + 1 + int((r >> 32) % (nHalfH - 1));
+            for (int y = y0; y < std::min(y0 + h, p.nTop + nHalfH); y++)
+                for (int x = x0; x < std::min(x0 + w, nHalfW); x++) {
+                    int mx = p.nWidth - 1 - x, my = p.nTop + nBottom - y;
+                    board.Set(x, y); board.Set(mx, y); board.Set(x, my); board.Set(mx, my);
+                }
+        }
+
+        // Spawns two tiles in from the side walls, on the centre line, with a
+        // tile of clearance all round
+        int k = TankTiles(p);
+        int ySpawn = p.nTop + (p.nHeight - p.nTop - k) / 2;
+        board.aSpawns[0] = { 2, ySpawn };
+        board.aSpawns[1] = { p.nWidth - 2 - k, ySpawn };
+        for (const olc::vi2d& s : board.aSpawns)
+            for (int y = s.y - 1; y <= s.y + k; y++)
+                for (int x = s.x - 1; x <= s.x + k; x++)
+                    board.Clear(x, y);
+    }
+
+    // aFree bit x of row y: a tank of k by k tiles fits with its top left at (x, y)
+    static void FreeSpots(const PackedBoard& board, int k, std::array<uint64_t, PackedBoard::nMaxHeight>& aFree)
+    {
+        uint64_t nRow = (board.nWidth == 64) ? ~uint64_t(0) : (uint64_t(1) << board.nWidth) - 1;
+        std::array<uint64_t, PackedBoard::nMaxHeight> aRun;
+        for (int y = 0; y < board.nHeight; y++) {
+            uint64_t nOpen = ~board.aWalls[y] & nRow;
+            aRun[y] = nOpen;
+            for (int i = 1; i < k; i++)
+                aRun[y] &= nOpen >> i;
+        }
+        for (int y = 0; y < board.nHeight; y++) {
+            aFree[y] = (y + k <= board.nHeight) ? aRun[y] : 0;
+            for (int i = 1; i < k && aFree[y]; i++)
+                aFree[y] &= aRun[y + i];
+        }
+    }
+
+    // Grows s along the runs of set bits in m that it touches, both ways, in
+    // six shift steps (Kogge-Stone occluded fill)
+    static uint64_t FillRow(uint64_t s, uint64_t m)
+    {
+        uint64_t up = s & m, down = up, mUp = m, mDown = m;
+        for (int n = 1; n < 64; n *= 2) {
+            up |= (up << n) & mUp;
+            mUp &= mUp << n;
+            down |= (down >> n) & mDown;
+            mDown &= mDown >> n;
+        }
+        return up | down;
+    }
+
+    // Spreads aReach through aFree, four-connected, until it stops growing:
+    // each pass fills every row along itself and from the rows beside it,
+    // downwards then back up
+    static void FloodFill(const std::array<uint64_t, PackedBoard::nMaxHeight>& aFree, int nHeight, std::array<uint64_t, PackedBoard::nMaxHeight>& aReach)
+    {
+        for (bool bGrew = true; bGrew; ) {
+            bGrew = false;
+            auto step = [&](int y) {
+                uint64_t n = aReach[y];
+                if (y > 0) n |= aReach[y - 1];
+                if (y + 1 < nHeight) n |= aReach[y + 1];
+                n = FillRow(n & aFree[y], aFree[y]);
+                if (n != aReach[y]) {
+                    aReach[y] = n;
+                    bGrew = true;
+                }
+            };
+            for (int y = 0; y < nHeight; y++)
+                step(y);
+            for (int y = nHeight - 1; y >= 0; y--)
+                step(y);
+        }
+    }
+
+    // Open tiles, up to nMax, from the edge of a tank at s in direction d
+    static int Sight(const PackedBoard& board, const olc::vi2d& s, int k, const olc::vi2d& d, int nMax)
+    {
+        int n = 0;
+        for (; n < nMax; n++) {
+            for (int i = 0; i < k; i++) {
+                int x = d.x > 0 ? s.x + k + n : d.x < 0 ? s.x - 1 - n : s.x + i;
+                int y = d.y > 0 ? s.y + k + n : d.y < 0 ? s.y - 1 - n : s.y + i;
+                if (x < 0 || y < 0 || x >= board.nWidth || y >= board.nHeight || board.Wall(x, y))
+                    return n;
+            }
+        }
+        return n;
+    }
+};
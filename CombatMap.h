@@ -0,0 +1,308 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CombatSim.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A file of boards: either one board in CombatBoard's text form, or any
+// number of them compiled into the binary form, which is memory-mapped. Open()
+// only reads the binary form's index, so a campaign of many boards costs a
+// mapping until one is picked; Board(i) decodes that one on first use and
+// keeps it.
+//
+// Binary, little-endian: "CMAP", u16 version, u16 0, u32 board count, then
+// per board {u64 CombatBoard::nHash, u32 offset, u32 size}, then the boards.
+// A board is u16 width, u16 height, u8 tile size, u8 red and u8 blue spawn
+// counts, the spawns as u16 x, y pixels, the tiles as one bit each (1 for a
+// wall, row by row, low bit first), then its merged wall rects cached as u32
+// count and u16 x, y, w, h in tiles each, so MergeTiles needn't run again.
+// Streamed boards merge their walls a chunk at a time as they're played, so
+// they cache none.
+class CombatMapFile
+{
+public:
+    static constexpr uint32_t nMagic = 0x50414D43;     // "CMAP"
+    static constexpr uint16_t nVersion = 1;
+
+    CombatMapFile() = default;
+    CombatMapFile(const CombatMapFile&) = delete;
+    CombatMapFile& operator=(const CombatMapFile&) = delete;
+    ~CombatMapFile() { Close(); }
+
+    // False, with the reason in sError, if the file can't be read or isn't boards
+    bool Open(const std::string& sFile)
+    {
+        Close();
+        if (!Map(sFile)) {
+            sError = "couldn't read " + sFile;
+            return false;
+        }
+        if (nSize >= 4 && Get(pData, 4) == nMagic)
+            return ReadIndex();
+
+        // Text: a single board, compiled now, and the file needn't stay mapped
+        std::string sText(reinterpret_cast<const char*>(pData), nSize);
+        Unmap();
+        auto board = CombatBoard::FromText(sText, &sError);
+        if (!board)
+            return false;
+        vEntries.push_back({ board->nHash, 0, 0 });
+        vBoards.push_back(board);
+        return true;
+    }
+
+    void Close()
+    {
+        Unmap();
+        vEntries.clear();
+        vBoards.clear();
+    }
+
+    int Count() const { return int(vEntries.size()); }
+
+    // Known from the index, so a replay's board can be found without decoding any
+    uint64_t BoardHash(int i) const { return vEntries[i].nHash; }
+
+    // Board i, or -1 for none with that hash
+    int Find(uint64_t nHash) const
+    {
+        for (int i = 0; i < Count(); i++)
+            if (vEntries[i].nHash == nHash)
+                return i;
+        return -1;
+    }
+
+    // Decodes board i the first time it's asked for; null, with the reason in
+    // sError, if its data is damaged
+    std::shared_ptr<const CombatBoard> Board(int i)
+    {
+        if (!vBoards[i]) {
+            vBoards[i] = Decode(pData + vEntries[i].nOffset, vEntries[i].nSize, &sError);
+            if (vBoards[i] && vBoards[i]->nHash != vEntries[i].nHash) {
+                sError = "board " + std::to_string(i) + " doesn't match its hash";
+                vBoards[i].reset();
+            }
+        }
+        return vBoards[i];
+    }
+
+    // Writes boards in the binary form
+    static bool Save(const std::string& sFile, const std::vector<std::shared_ptr<const CombatBoard>>& vBoardsToSave)
+    {
+        std::vector<uint8_t> v;
+        Put(v, nMagic, 4); Put(v, nVersion, 2); Put(v, 0, 2); Put(v, uint32_t(vBoardsToSave.size()), 4);
+        size_t nIndex = v.size();
+        v.resize(v.size() + 16 * vBoardsToSave.size());
+        for (size_t i = 0; i < vBoardsToSave.size(); i++) {
+            size_t nOffset = v.size();
+            Encode(*vBoardsToSave[i], v);
+            uint8_t* p = v.data() + nIndex + 16 * i;
+            for (int b = 0; b < 8; b++) p[b] = uint8_t(vBoardsToSave[i]->nHash >> (8 * b));
+            for (int b = 0; b < 4; b++) p[8 + b] = uint8_t(nOffset >> (8 * b));
+            for (int b = 0; b < 4; b++) p[12 + b] = uint8_t((v.size() - nOffset) >> (8 * b));
+        }
+        std::ofstream f(sFile, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(v.data()), std::streamsize(v.size()));
+        return bool(f);
+    }
+
+    std::string sError;             // Why the last Open or Board failed
+
+private:
+    struct Entry
+    {
+        uint64_t nHash;
+        uint32_t nOffset, nSize;
+    };
+    std::vector<Entry> vEntries;
+    std::vector<std::shared_ptr<const CombatBoard>> vBoards;   // Null until decoded
+    const uint8_t* pData = nullptr;
+    size_t nSize = 0;
+#if defined(_WIN32)
+    HANDLE hFile = INVALID_HANDLE_VALUE, hMapping = nullptr;
+#endif
+
+    static uint64_t Get(const uint8_t* p, int nBytes)
+    {
+        uint64_t n = 0;
+        for (int i = 0; i < nBytes; i++) n |= uint64_t(p[i]) << (8 * i);
+        return n;
+    }
+    static void Put(std::vector<uint8_t>& v, uint64_t n, int nBytes) { for (int i = 0; i < nBytes; i++) v.push_back(uint8_t(n >> (8 * i))); }
+
+    bool ReadIndex()
+    {
+        if (nSize < 12 || Get(pData + 4, 2) != nVersion) {
+            sError = "unsupported map file version";
+            return false;
+        }
+        uint32_t nCount = uint32_t(Get(pData + 8, 4));
+        if (nCount > (nSize - 12) / 16) {
+            sError = "map file index is cut short";
+            return false;
+        }
+        for (uint32_t i = 0; i < nCount; i++) {
+            const uint8_t* p = pData + 12 + 16 * size_t(i);
+            Entry e = { Get(p, 8), uint32_t(Get(p + 8, 4)), uint32_t(Get(p + 12, 4)) };
+            if (e.nOffset > nSize || e.nSize > nSize - e.nOffset) {
+                sError = "board " + std::to_string(i) + " lies outside the file";
+                return false;
+            }
+            vEntries.push_back(e);
+        }
+        vBoards.resize(vEntries.size());
+        return true;
+    }
+
+    static void Encode(const CombatBoard& board, std::vector<uint8_t>& v)
+    {
+        Put(v, uint32_t(board.nBoardWidth), 2); Put(v, uint32_t(board.nBoardHeight), 2); Put(v, uint32_t(board.nSquareSize), 1);
+        Put(v, uint32_t(board.vSpawns[0].size()), 1); Put(v, uint32_t(board.vSpawns[1].size()), 1);
+        for (const std::vector<olc::vf2d>& vTeam : board.vSpawns)
+            for (const olc::vf2d& p : vTeam) {
+                Put(v, uint32_t(p.x), 2); Put(v, uint32_t(p.y), 2);
+            }
+        size_t nBits = v.size();
+        v.resize(v.size() + (board.sBoard.size() + 7) / 8, 0);
+        for (size_t i = 0; i < board.sBoard.size(); i++)
+            if (board.sBoard[i] == L'#')
+                v[nBits + i / 8] |= uint8_t(1 << (i % 8));
+        float fSquare = float(board.nSquareSize);
+        Put(v, uint32_t(board.vRects.size()), 4);
+        for (const olc::aabb::rect& r : board.vRects) {
+            Put(v, uint32_t(r.pos.x / fSquare), 2); Put(v, uint32_t(r.pos.y / fSquare), 2);
+            Put(v, uint32_t(r.size.x / fSquare), 2); Put(v, uint32_t(r.size.y / fSquare), 2);
+        }
+    }
+
+    // The cached rects are checked to be walls, inside the board, and to
+    // cover every wall tile exactly once, so a damaged file can't leave
+    // holes or phantom walls; the board itself is held to
+    // CombatBoard::Problem(), as FromText() holds it
+    static std::shared_ptr<const CombatBoard> Decode(const uint8_t* p, size_t n, std::string* pError)
+    {
+        auto fail = [&](const std::string& sWhy) {
+            *pError = sWhy;
+            return std::shared_ptr<const CombatBoard>();
+        };
+        size_t nPos = 0;
+        bool bOk = true;
+        auto get = [&](int nBytes) {
+            if (nPos + nBytes > n) { bOk = false; return uint64_t(0); }
+            uint64_t v = Get(p + nPos, nBytes);
+            nPos += nBytes;
+            return v;
+        };
+
+        int nWidth = int(get(2)), nHeight = int(get(2)), nSquare = int(get(1));
+        if (!bOk || nWidth < 1 || nHeight < 1 || nSquare < 1)
+            return fail("bad board dimensions");
+        std::string sWhy = CombatBoard::Problem(L"", nWidth, nHeight, nSquare);
+        if (!sWhy.empty())
+            return fail(sWhy);
+        CombatBoard::Spawns vSpawns;
+        int aSpawns[2] = { int(get(1)), int(get(1)) };
+        for (int t = 0; t < 2; t++)
+            for (int i = 0; i < aSpawns[t]; i++) {
+                float x = float(get(2)), y = float(get(2));
+                vSpawns[t].push_back({ x, y });
+            }
+        size_t nTiles = size_t(nWidth) * nHeight;
+        if (!bOk || nPos + (nTiles + 7) / 8 > n)
+            return fail("board is cut short");
+        std::wstring sBoard(nTiles, L'.');
+        for (size_t i = 0; i < nTiles; i++)
+            if (p[nPos + i / 8] & (1 << (i % 8)))
+                sBoard[i] = L'#';
+        nPos += (nTiles + 7) / 8;
+
+        size_t nRects = size_t(get(4));
+        if (!bOk || nRects > (n - nPos) / 8)
+            return fail("board is cut short");
+        bool bStreamed = nWidth > CombatBoard::nStreamTiles || nHeight > CombatBoard::nStreamTiles;
+        if (bStreamed && nRects > 0)
+            return fail("cached wall rects on a streamed board");
+        std::vector<olc::aabb::rect> vRects(nRects);
+        std::vector<uint8_t> vCovered(nTiles, 0);
+        for (olc::aabb::rect& r : vRects) {
+            int x = int(get(2)), y = int(get(2)), w = int(get(2)), h = int(get(2));
+            if (!bOk || w < 1 || h < 1 || x + w > nWidth || y + h > nHeight)
+                return fail("bad cached wall rect");
+            for (int ty = y; ty < y + h; ty++)
+                for (int tx = x; tx < x + w; tx++) {
+                    size_t i = size_t(ty) * nWidth + tx;
+                    if (sBoard[i] != L'#' || vCovered[i]++)
+                        return fail("cached wall rects don't match the tiles");
+                }
+            r = { { float(x * nSquare), float(y * nSquare) }, { float(w * nSquare), float(h * nSquare) } };
+        }
+        if (!bOk || nPos != n)
+            return fail("board is cut short");
+        if (!bStreamed && size_t(std::count(vCovered.begin(), vCovered.end(), 1)) != size_t(std::count(sBoard.begin(), sBoard.end(), L'#')))
+            return fail("cached wall rects don't match the tiles");
+        sWhy = CombatBoard::Problem(sBoard, nWidth, nHeight, nSquare, vSpawns);
+        if (!sWhy.empty())
+            return fail(sWhy);
+        return CombatBoard::Compile(sBoard, nWidth, nHeight, nSquare, vSpawns, &vRects);
+    }
+
+    bool Map(const std::string& sFile)
+    {
+#if defined(_WIN32)
+        hFile = CreateFileA(sFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER nFileSize;
+        if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &nFileSize) || nFileSize.QuadPart == 0) {
+            Unmap();
+            return false;
+        }
+        hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        pData = hMapping ? static_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        nSize = size_t(nFileSize.QuadPart);
+#else
+        int fd = open(sFile.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        pData = (p == MAP_FAILED) ? nullptr : static_cast<const uint8_t*>(p);
+        nSize = size_t(st.st_size);
+#endif
+        if (!pData)
+            Unmap();
+        return pData != nullptr;
+    }
+
+    void Unmap()
+    {
+#if defined(_WIN32)
+        if (pData) UnmapViewOfFile(pData);
+        if (hMapping) CloseHandle(hMapping);
+        if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+        hMapping = nullptr;
+        hFile = INVALID_HANDLE_VALUE;
+#else
+        if (pData) munmap(const_cast<uint8_t*>(pData), nSize);
+#endif
+        pData = nullptr;
+        nSize = 0;
+    }
+};
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CombatFlow.h"
+#include "CombatTrace.h"
+
+// A* paths between single cells of a board, for AI that wants its own route
+// rather than the way to whichever goal a FlowField finds nearest. Cells are
+// FlowField's: where a tank's corner can sit with the tank clear of walls,
+// stepping eight ways and never cutting a corner. Steps cost 2 straight and
+// 3 diagonally, so the octile heuristic stays in integers and the same query
+// always gives the same path.
+//
+// Queries go in batches, one Solve() a tick for every AI tank, and are
+// answered from a cache keyed on start cell, goal cell and board revision
+// where they can be. Since a path is a function of that key alone, a cached
+// answer is exactly what searching again would give, so the cache never
+// changes what a sim does. The misses are searched on the calling thread,
+// or spread over the workers Start() gives it, and then cached in order, so
+// the cache ends up the same however many threads there are.
+//
+// A tank only needs the cell to head for next, so that and the length are
+// all a search leaves behind; the tank asks again from the next cell, which
+// is another key. Each thread searches with its own Searcher, whose per-cell
+// state is stamped rather than cleared between queries, so a search costs
+// the cells it reaches and not the board. Its heap holds one key per open
+// cell, moved up in place when a cell is reached more cheaply. Nothing
+// allocates after Build() and Start() in batches of up to nMaxQueries.
+class PathService
+{
+public:
+    static constexpr int nCacheSize = 4096;         // Entries, a power of two
+    static constexpr int nCacheWays = 2;            // Slots a key may go in
+    static constexpr int nLatencyWindow = 1024;     // Searches the latency stats cover
+    static constexpr int nMaxCells = 1 << 19;       // Board width times height
+
+    struct Query
+    {
+        int nStart = 0, nGoal = 0;      // Cells, y * nWidth + x
+        int nNext = -1;                 // The cell after nStart on the path, -1 on the goal or with no path
+        int nLength = -1;               // Steps to the goal, -1 with no path
+        bool bCached = false;           // Answered without a search
+    };
+
+    struct Stats
+    {
+        uint64_t nQueries = 0, nHits = 0, nSearches = 0, nExpanded = 0;
+        float fMeanUs = 0, fP99Us = 0, fMaxUs = 0;  // Per search, over the last nLatencyWindow
+    };
+
+    int nWidth = 0, nHeight = 0;
+    std::vector<uint8_t> vOpen;
+    uint32_t nRevision = 0;             // Bumped by every Build() that changes the board
+
+    PathService() = default;
+    PathService(const PathService&) = delete;
+    PathService& operator=(const PathService&) = delete;
+    ~PathService() { Stop(); }
+
+    // Whether Build() takes a board this size: the heap's keys hold a cell
+    // in so many bits
+    static bool Fits(int nBoardWidth, int nBoardHeight) { return int64_t(nBoardWidth) * nBoardHeight <= nMaxCells; }
+
+    // Leaves the board alone if nBoardHash and nTankTiles are what the last
+    // call had, so a sim can call it every match and keep its cache. False,
+    // with no cells so that every query comes back without a path, for a
+    // board that doesn't Fits().
+    bool Build(const std::wstring& sBoard, int nBoardWidth, int nBoardHeight, int nTankTiles, int nMaxQueries, uint64_t nBoardHash)
+    {
+        vMisses.reserve(size_t(nMaxQueries));
+        vMissOf.reserve(size_t(nMaxQueries));
+        if (vSearchers.empty())
+            vSearchers.resize(1);
+        if (vCache.empty())
+            vCache.resize(nCacheSize);
+        if (nRevision > 0 && nBoardHash == nBuiltHash && nTankTiles == nBuiltTiles)
+            return !vOpen.empty();
+        nBuiltHash = nBoardHash;
+        nBuiltTiles = nTankTiles;
+        nRevision++;
+        if (!Fits(nBoardWidth, nBoardHeight)) {
+            nWidth = nHeight = 0;
+            vOpen.clear();
+            vSteps.clear();
+            vReach.clear();
+            for (Searcher& s : vSearchers)
+                s.Reset(0);
+            return false;
+        }
+        nWidth = nBoardWidth;
+        nHeight = nBoardHeight;
+        FlowField::OpenCells(sBoard, nWidth, nHeight, nTankTiles, vOpen);
+        vSteps.assign(vOpen.size(), 0);
+        vReach.assign(vOpen.size(), 0);
+        for (int y = 0; y < nHeight; y++)
+            for (int x = 0; x < nWidth; x++)
+                for (int k = 0; k < 8; k++) {
+                    int nx = x + aMove[k][0], ny = y + aMove[k][1];
+                    if ((k & 1) && (!Open(nx, y) || !Open(x, ny)))
+                        continue;
+                    size_t c = size_t(y) * nWidth + x;
+                    if (nx >= 0 && ny >= 0 && nx < nWidth && ny < nHeight)
+                        vReach[c] |= uint8_t(1 << k);
+                    if (Open(nx, ny))
+                        vSteps[c] |= uint8_t(1 << k);
+                }
+        for (Searcher& s : vSearchers)
+            s.Reset(vOpen.size());
+        return true;
+    }
+
+    // nThreads - 1 workers search alongside the thread calling Solve()
+    void Start(int nThreads)
+    {
+        Stop();
+        nThreads = std::max(1, nThreads);
+        vSearchers.resize(size_t(nThreads));
+        for (Searcher& s : vSearchers)
+            s.Reset(vOpen.size());
+        for (int t = 1; t < nThreads; t++)
+            vWorkers.emplace_back([this, t]() { Worker(t); });
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mux);
+            bQuit = true;
+        }
+        cvStart.notify_all();
+        for (auto& th : vWorkers)
+            th.join();
+        vWorkers.clear();
+        bQuit = false;
+    }
+
+    // Answers every query, each one as if on its own
+    void Solve(Query* pQueries, int nQueries)
+    {
+        TraceRecorder::Scope trace("paths");
+        assert(!vSearchers.empty() && "Solve() before Build()");
+        vMisses.clear();
+        vMissOf.resize(size_t(nQueries));
+        for (int q = 0; q < nQueries; q++) {
+            Query& query = pQueries[q];
+            vMissOf[q] = -1;
+            stats.nQueries++;
+            if (Lookup(query)) {
+                stats.nHits++;
+                continue;
+            }
+            // Twice in one batch is searched once
+            auto it = std::find_if(vMisses.begin(), vMisses.end(), [&](const Miss& m) { return m.nStart == query.nStart && m.nGoal == query.nGoal; });
+            vMissOf[q] = int(it - vMisses.begin());
+            if (it == vMisses.end())
+                vMisses.push_back({ query.nStart, query.nGoal });
+        }
+
+        if (vMisses.empty())
+            return;
+        if (vWorkers.empty() || vMisses.size() == 1)
+            for (Miss& m : vMisses)
+                Search(vSearchers[0], m);
+        else
+            Farm();
+        for (const Miss& m : vMisses)
+            Store(m);
+        for (int q = 0; q < nQueries; q++)
+            if (vMissOf[q] >= 0) {
+                const Miss& m = vMisses[vMissOf[q]];
+                pQueries[q].nNext = m.nNext;
+                pQueries[q].nLength = m.nLength;
+                pQueries[q].bCached = false;
+            }
+    }
+
+    void ClearCache()
+    {
+        std::fill(vCache.begin(), vCache.end(), Entry());
+    }
+
+    Stats GetStats() const
+    {
+        Stats s = stats;
+        int n = int(std::min<uint64_t>(stats.nSearches, nLatencyWindow));
+        if (n == 0)
+            return s;
+        std::vector<float> v(aLatency.begin(), aLatency.begin() + n);
+        std::sort(v.begin(), v.end());
+        for (float f : v)
+            s.fMeanUs += f / float(n);
+        s.fP99Us = v[std::min(n - 1, n * 99 / 100)];
+        s.fMaxUs = v.back();
+        return s;
+    }
+
+    void ResetStats() { stats = Stats(); }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // The eight ways to step, as FlowField's headings 0, 2, .. 14 go
+    static constexpr int aMove[8][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 } };
+
+    struct Entry
+    {
+        int nStart = -1, nGoal = -1;
+        uint32_t nRevision = 0;
+        int nNext = -1, nLength = -1;
+    };
+
+    struct Miss
+    {
+        int nStart, nGoal;
+        int nNext = -1, nLength = -1;
+        int nExpanded = 0;
+        float fUs = 0;
+    };
+
+    // A cell as one search sees it, good where nStamp is that search's. All
+    // of it together, so a cell the search reaches costs one cache line
+    struct Node
+    {
+        int nG = 0;
+        int nParent = -1;
+        int nHeapPos = -1;
+        uint32_t nStamp = 0;
+    };
+
+    // One thread's A*
+    struct Searcher
+    {
+        std::vector<Node> vNodes;                   // Per cell
+        std::vector<uint64_t> vHeap;                // Key()s, least first
+        uint32_t nStamp = 0;
+
+        void Reset(size_t nCells)
+        {
+            vNodes.assign(nCells, Node());
+            vHeap.assign(nCells, 0);
+            nStamp = 0;
+        }
+    };
+
+    // Per cell, bit k set where step k doesn't cut a corner and lands on an
+    // open cell, or for vReach on any cell of the board. Worked out in Build()
+    // so a search tests a byte instead of up to three cells per step
+    std::vector<uint8_t> vSteps, vReach;
+
+    std::vector<Searcher> vSearchers;
+    std::vector<Miss> vMisses;
+    std::vector<int> vMissOf;           // Per query in the batch, its vMisses index or -1
+    std::vector<Entry> vCache;          // nCacheSize once built, in sets of nCacheWays, newest first
+    uint64_t nBuiltHash = 0;
+    int nBuiltTiles = 0;
+    Stats stats;
+    std::array<float, nLatencyWindow> aLatency = {};
+
+    std::vector<std::thread> vWorkers;
+    std::mutex mux;
+    std::condition_variable cvStart, cvDone;
+    uint64_t nGeneration = 0;           // Bumped by every batch farmed out; guarded by mux
+    bool bQuit = false;
+    std::atomic<int> nNext{ 0 };        // Next miss to hand out
+    std::atomic<int> nBusy{ 0 };        // Workers yet to finish this batch
+
+    // The first slot of the key's set
+    size_t Slot(int nStart, int nGoal) const
+    {
+        uint64_t h = (uint64_t(uint32_t(nStart)) << 32 | uint32_t(nGoal)) * 0x9E3779B97F4A7C15ull ^ nRevision;
+        return size_t((h ^ (h >> 29)) & (nCacheSize / nCacheWays - 1)) * nCacheWays;
+    }
+
+    bool Lookup(Query& q) const
+    {
+        size_t nSlot = Slot(q.nStart, q.nGoal);
+        for (int w = 0; w < nCacheWays; w++) {
+            const Entry& e = vCache[nSlot + w];
+            if (e.nStart != q.nStart || e.nGoal != q.nGoal || e.nRevision != nRevision)
+                continue;
+            q.nNext = e.nNext;
+            q.nLength = e.nLength;
+            q.bCached = true;
+            return true;
+        }
+        return false;
+    }
+
+    // Caches a miss at the front of its set, over the oldest entry there
+    void Store(const Miss& m)
+    {
+        Entry* pSet = &vCache[Slot(m.nStart, m.nGoal)];
+        std::copy_backward(pSet, pSet + nCacheWays - 1, pSet + nCacheWays);
+        pSet[0] = { m.nStart, m.nGoal, nRevision, m.nNext, m.nLength };
+        aLatency[size_t(stats.nSearches % nLatencyWindow)] = m.fUs;
+        stats.nSearches++;
+        stats.nExpanded += uint64_t(m.nExpanded);
+    }
+
+    // Waits for every worker, not just every miss, so none is still looking
+    // at this batch when the next one is filled in
+    void Farm()
+    {
+        nBusy.store(int(vWorkers.size()), std::memory_order_relaxed);
+        nNext.store(0, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mux);
+            nGeneration++;
+        }
+        cvStart.notify_all();
+        Work(vSearchers[0]);
+        std::unique_lock<std::mutex> lock(mux);
+        cvDone.wait(lock, [&]() { return nBusy.load(std::memory_order_acquire) == 0; });
+    }
+
+    void Worker(int t)
+    {
+        TraceRecorder::NameThread("path worker");
+        uint64_t nSeen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mux);
+                cvStart.wait(lock, [&]() { return bQuit || nGeneration != nSeen; });
+                if (bQuit)
+                    return;
+                nSeen = nGeneration;
+            }
+            Work(vSearchers[size_t(t)]);
+            if (nBusy.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mux);
+                cvDone.notify_one();
+            }
+        }
+    }
+
+    // Takes misses until none are left
+    void Work(Searcher& s)
+    {
+        int nMisses = int(vMisses.size());
+        for (int i = nNext.fetch_add(1, std::memory_order_acq_rel); i < nMisses; i = nNext.fetch_add(1, std::memory_order_acq_rel))
+            Search(s, vMisses[size_t(i)]);
+    }
+
+    static int Heuristic(int x, int y, int gx, int gy)
+    {
+        int dx = std::abs(x - gx), dy = std::abs(y - gy);
+        return 2 * std::max(dx, dy) + std::min(dx, dy);
+    }
+
+    bool Open(int x, int y) const { return x >= 0 && y >= 0 && x < nWidth && y < nHeight && vOpen[size_t(y) * nWidth + x]; }
+
+    // Cells come off the heap by f, then larger g, then lower cell, which is
+    // the order of these keys; nMaxCells keeps each field in its bits
+    static constexpr int nKeyBits = 21;
+    static constexpr uint64_t nKeyMask = (uint64_t(1) << nKeyBits) - 1;
+    static uint64_t Key(int f, int g, int c) { return uint64_t(f) << (2 * nKeyBits) | (nKeyMask - uint64_t(g)) << nKeyBits | uint64_t(c); }
+    static int Cell(uint64_t nKey) { return int(nKey & nKeyMask); }
+
+    static void SiftUp(Searcher& s, int nPos)
+    {
+        uint64_t c = s.vHeap[nPos];
+        while (nPos > 0) {
+            int nParent = (nPos - 1) / 2;
+            uint64_t p = s.vHeap[nParent];
+            if (p < c)
+                break;
+            s.vHeap[nPos] = p;
+            s.vNodes[Cell(p)].nHeapPos = nPos;
+            nPos = nParent;
+        }
+        s.vHeap[nPos] = c;
+        s.vNodes[Cell(c)].nHeapPos = nPos;
+    }
+
+    static void SiftDown(Searcher& s, int nPos, int nSize)
+    {
+        uint64_t c = s.vHeap[nPos];
+        for (;;) {
+            int nChild = 2 * nPos + 1;
+            if (nChild >= nSize)
+                break;
+            nChild += nChild + 1 < nSize && s.vHeap[nChild + 1] < s.vHeap[nChild];
+            uint64_t d = s.vHeap[nChild];
+            if (c < d)
+                break;
+            s.vHeap[nPos] = d;
+            s.vNodes[Cell(d)].nHeapPos = nPos;
+            nPos = nChild;
+        }
+        s.vHeap[nPos] = c;
+        s.vNodes[Cell(c)].nHeapPos = nPos;
+    }
+
+    // Fills in m's answer. The start and goal needn't be open, like a tank
+    // squeezed against a wall, but every cell between them is.
+    void Search(Searcher& s, Miss& m) const
+    {
+        auto tp = clock::now();
+        m.nNext = m.nLength = -1;
+        m.nExpanded = 0;
+        int nCells = int(vOpen.size());
+        bool bValid = m.nStart >= 0 && m.nStart < nCells && m.nGoal >= 0 && m.nGoal < nCells;
+        if (bValid && m.nStart == m.nGoal)
+            m.nLength = 0;
+        else if (bValid) {
+            if (++s.nStamp == 0) {
+                for (Node& n : s.vNodes)
+                    n.nStamp = 0;
+                s.nStamp = 1;
+            }
+            int gx = m.nGoal % nWidth, gy = m.nGoal / nWidth;
+            bool bGoalOpen = vOpen[m.nGoal];
+            int nSize = 0;
+            Node& start = s.vNodes[m.nStart];
+            start.nStamp = s.nStamp;
+            start.nG = 0;
+            start.nParent = -1;
+            start.nHeapPos = 0;
+            s.vHeap[nSize++] = Key(Heuristic(m.nStart % nWidth, m.nStart / nWidth, gx, gy), 0, m.nStart);
+            while (nSize > 0) {
+                int c = Cell(s.vHeap[0]);
+                s.vNodes[c].nHeapPos = -1;      // Closed
+                if (--nSize > 0) {
+                    s.vHeap[0] = s.vHeap[nSize];
+                    SiftDown(s, 0, nSize);
+                }
+                m.nExpanded++;
+                if (c == m.nGoal) {
+                    m.nNext = c;
+                    m.nLength = 1;
+                    for (; s.vNodes[m.nNext].nParent != m.nStart; m.nNext = s.vNodes[m.nNext].nParent)
+                        m.nLength++;
+                    break;
+                }
+                int x = c % nWidth, y = c / nWidth;
+                int gc = s.vNodes[c].nG;
+                unsigned nSteps = vSteps[c];
+                if (!bGoalOpen && std::abs(x - gx) <= 1 && std::abs(y - gy) <= 1)
+                    for (int k = 0; k < 8; k++)
+                        if (x + aMove[k][0] == gx && y + aMove[k][1] == gy)
+                            nSteps |= vReach[c] & (1u << k);
+                for (int k = 0; k < 8; k++) {
+                    if (!(nSteps >> k & 1))
+                        continue;
+                    int nx = x + aMove[k][0], ny = y + aMove[k][1];
+                    int n = ny * nWidth + nx;
+                    int g = gc + ((k & 1) ? 3 : 2);
+                    Node& node = s.vNodes[n];
+                    if (node.nStamp != s.nStamp) {
+                        node.nStamp = s.nStamp;
+                        node.nG = g;
+                        node.nParent = c;
+                        s.vHeap[nSize] = Key(g + Heuristic(nx, ny, gx, gy), g, n);
+                        SiftUp(s, nSize++);
+                    }
+                    else if (node.nHeapPos >= 0 && g < node.nG) {
+                        node.nG = g;
+                        node.nParent = c;
+                        s.vHeap[node.nHeapPos] = Key(g + Heuristic(nx, ny, gx, gy), g, n);
+                        SiftUp(s, node.nHeapPos);
+                    }
+                }
+            }
+        }
+        m.fUs = std::chrono::duration<float, std::micro>(clock::now() - tp).count();
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include "CombatTrace.h"
+
+// Per-stage frame timings over a rolling window of frames. A stage can be
+// timed several times per frame (one sim tick each, one upload per layer);
+// its times add up until the frame ends. The profiler is active on a thread
+// once pActive points at it, and Scope costs one branch when it isn't, so
+// CombatSim can stay instrumented in headless and farm builds. Every stage
+// also goes to the TraceRecorder, which drops it unless tracing is enabled.
+class FrameProfiler
+{
+public:
+    enum Stage
+    {
+        STAGE_INPUT,        // Hardware scan and key sampling
+        STAGE_AI,           // Tank steering, AI and player, and AI firing
+        STAGE_BULLETS,      // Bullet sweeps and hits
+        STAGE_TANKS,        // Tank sweeps
+        STAGE_DECALS,       // Decal submission, app and renderer side
+        STAGE_UPLOAD,       // Layer UpdateTexture
+        STAGE_DISPLAY,      // DisplayFrame
+        STAGE_FRAME,        // All of olc_CoreUpdate
+        STAGE_COUNT
+    };
+
+    static constexpr int nWindow = 300;     // Frames the stats cover, 5s at 60fps
+
+    struct Stats
+    {
+        float fMin = 0, fAvg = 0, fP99 = 0; // Milliseconds
+    };
+
+    static inline thread_local FrameProfiler* pActive = nullptr;
+
+    static const char* StageName(int s)
+    {
+        static const char* const sNames[STAGE_COUNT] = { "input", "ai", "bullets", "tanks", "decals", "upload", "display", "frame" };
+        return sNames[s];
+    }
+
+    void Begin(Stage s)
+    {
+        TraceRecorder::Begin(StageName(s));
+        aStart[s] = clock::now();
+    }
+
+    // Ending STAGE_FRAME closes the frame and records every stage's total
+    void End(Stage s)
+    {
+        aAccum[s] += std::chrono::duration<float, std::milli>(clock::now() - aStart[s]).count();
+        TraceRecorder::End(StageName(s));
+        if (s == STAGE_FRAME) {
+            int nSlot = int(nFrames % nWindow);
+            for (int i = 0; i < STAGE_COUNT; i++) {
+                aSamples[i][nSlot] = aAccum[i];
+                aAccum[i] = 0;
+            }
+            nFrames++;
+        }
+    }
+
+    // Times one stage for the life of the scope, on the thread's active profiler if any
+    struct Scope
+    {
+        FrameProfiler* p;
+        Stage s;
+        explicit Scope(Stage stage) : p(pActive), s(stage) { if (p) p->Begin(s); }
+        ~Scope() { if (p) p->End(s); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    int FramesInWindow() const { return int(std::min<long long>(nFrames, nWindow)); }
+
+    Stats Get(Stage s) const
+    {
+        Stats st;
+        int n = FramesInWindow();
+        if (n == 0)
+            return st;
+        std::array<float, nWindow> aSorted;
+        std::copy(aSamples[s].begin(), aSamples[s].begin() + n, aSorted.begin());
+        float fSum = 0;
+        st.fMin = aSorted[0];
+        for (int i = 0; i < n; i++) {
+            fSum += aSorted[i];
+            st.fMin = std::min(st.fMin, aSorted[i]);
+        }
+        st.fAvg = fSum / n;
+        int nP99 = std::max(0, (n * 99 + 99) / 100 - 1);
+        std::nth_element(aSorted.begin(), aSorted.begin() + nP99, aSorted.begin() + n);
+        st.fP99 = aSorted[nP99];
+        return st;
+    }
+
+    // One row per frame in the window, oldest first, then min/avg/p99 rows
+    bool SaveCSV(const std::string& sFile) const
+    {
+        std::ofstream f(sFile);
+        if (!f)
+            return false;
+        f << "frame";
+        for (int s = 0; s < STAGE_COUNT; s++)
+            f << "," << StageName(s) << "_ms";
+        f << "\n";
+        int n = FramesInWindow();
+        for (long long i = nFrames - n; i < nFrames; i++) {
+            f << i;
+            for (int s = 0; s < STAGE_COUNT; s++)
+                f << "," << aSamples[s][i % nWindow];
+            f << "\n";
+        }
+        std::array<Stats, STAGE_COUNT> aStats;
+        for (int s = 0; s < STAGE_COUNT; s++)
+            aStats[s] = Get(Stage(s));
+        for (auto [sRow, pField] : { std::pair{ "min", &Stats::fMin }, { "avg", &Stats::fAvg }, { "p99", &Stats::fP99 } }) {
+            f << sRow;
+            for (int s = 0; s < STAGE_COUNT; s++)
+                f << "," << aStats[s].*pField;
+            f << "\n";
+        }
+        return bool(f);
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+    std::array<clock::time_point, STAGE_COUNT> aStart;
+    std::array<float, STAGE_COUNT> aAccum = {};
+    std::array<std::array<float, nWindow>, STAGE_COUNT> aSamples = {};
+    long long nFrames = 0;
+};
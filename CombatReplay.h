@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "CombatSim.h"
+
+// A match stored as the input it was played with: one CombatInput::Bits()
+// mask per player per tick, plus the board hash and rules to set the match
+// up again.
+// Re-simulating a replay reproduces the match exactly on the build that
+// recorded it, and on any build when rules.bDeterministic is set; nFinalHash
+// confirms it did. Before version 4 the state hash also covered spent
+// bullets, so older files still replay but can't be checked that way.
+//
+// On disk, little-endian: "CMBR", u16 version, u32 seed, u64 board hash,
+// the rules (with u8 tank and bullet counts since version 3), u32 tick
+// count, u64 final hash, then the masks as runs of {u8 mask per player,
+// LEB128 length}. Held keys make for long runs, so a full match is a KB or
+// two.
+struct CombatReplay
+{
+    static constexpr uint32_t nMagic = 0x52424D43;     // "CMBR"
+    static constexpr uint16_t nVersion = 7;            // 2: two-player matches; 3: tank and bullet counts; 4: pooled bullets' hash; 5: rules.bFlowAI; 6: rules.bPathAI; 7: rules.bSightAI
+
+    uint32_t nSeed = 0;                 // Seed of whatever drove the player, kept for reference
+    uint64_t nBoardHash = 0;            // CombatBoard::nHash of the board played on
+    CombatRules rules;
+    uint64_t nFinalHash = 0;            // CombatSim::StateHash() after the last tick; 0 when loaded from before version 4
+    std::vector<uint16_t> vInputs;      // Per tick, the second player's mask in the high byte
+
+    // Starts recording the match sim was just Create()d for
+    void Begin(const CombatSim& sim, uint32_t seed = 0)
+    {
+        nSeed = seed;
+        nBoardHash = sim.board->nHash;
+        rules = sim.rules;
+        nFinalHash = 0;
+        vInputs.clear();
+    }
+
+    void Record(const CombatInput& in, const CombatInput& in2 = {}) { vInputs.push_back(uint16_t(in.Bits() | (in2.Bits() << 8))); }
+
+    // Stamps the state the recorded ticks led to; call before Save
+    void Finish(const CombatSim& sim) { nFinalHash = sim.StateHash(); }
+
+    int Ticks() const { return int(vInputs.size()); }
+
+    CombatInput Input(int nTick) const { return (nTick < Ticks()) ? CombatInput::FromBits(uint8_t(vInputs[nTick])) : CombatInput(); }
+    CombatInput Input2(int nTick) const { return (nTick < Ticks()) ? CombatInput::FromBits(uint8_t(vInputs[nTick] >> 8)) : CombatInput(); }
+
+    bool Save(const std::string& sFile) const
+    {
+        std::vector<uint8_t> v;
+        auto put = [&](uint64_t n, int nBytes) { for (int i = 0; i < nBytes; i++) v.push_back(uint8_t(n >> (8 * i))); };
+        auto putf = [&](float f) { uint32_t n; std::memcpy(&n, &f, 4); put(n, 4); };
+
+        put(nMagic, 4); put(nVersion, 2); put(nSeed, 4); put(nBoardHash, 8);
+        put(rules.bDeterministic | (rules.bTwoPlayer << 1) | (rules.bFlowAI << 2) | (rules.bPathAI << 3) | (rules.bSightAI << 4), 1); put(uint32_t(rules.nScoreLimit), 4); putf(rules.fAISpeed); putf(rules.fAIFireDelay);
+        put(uint32_t(rules.nTanks), 1); put(uint32_t(rules.nBulletsPerTank), 1);
+        put(uint32_t(vInputs.size()), 4); put(nFinalHash, 8);
+
+        for (size_t i = 0; i < vInputs.size(); ) {
+            size_t j = i;
+            while (j < vInputs.size() && vInputs[j] == vInputs[i]) j++;
+            put(vInputs[i], rules.bTwoPlayer ? 2 : 1);
+            for (uint64_t nRun = j - i; ; nRun >>= 7) {
+                v.push_back(uint8_t((nRun & 0x7F) | (nRun > 0x7F ? 0x80 : 0)));
+                if (nRun <= 0x7F) break;
+            }
+            i = j;
+        }
+
+        std::ofstream f(sFile, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(v.data()), std::streamsize(v.size()));
+        return bool(f);
+    }
+
+    bool Load(const std::string& sFile)
+    {
+        std::ifstream f(sFile, std::ios::binary);
+        if (!f)
+            return false;
+        std::vector<uint8_t> v((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+        size_t nPos = 0;
+        bool bOk = true;
+        auto get = [&](int nBytes) {
+            uint64_t n = 0;
+            if (nPos + nBytes > v.size()) { bOk = false; return n; }
+            for (int i = 0; i < nBytes; i++) n |= uint64_t(v[nPos++]) << (8 * i);
+            return n;
+        };
+        auto getf = [&]() { uint32_t n = uint32_t(get(4)); float f; std::memcpy(&f, &n, 4); return f; };
+
+        uint32_t nFileMagic = uint32_t(get(4));
+        uint16_t nFileVersion = uint16_t(get(2));
+        if (nFileMagic != nMagic || nFileVersion < 1 || nFileVersion > nVersion || !bOk)
+            return false;
+        nSeed = uint32_t(get(4));
+        nBoardHash = get(8);
+        uint8_t nFlags = uint8_t(get(1));
+        rules.bDeterministic = nFlags & 1;
+        rules.bTwoPlayer = nFlags & 2;
+        rules.bFlowAI = nFlags & 4;
+        rules.bPathAI = nFlags & 8;
+        rules.bSightAI = nFlags & 16;
+        rules.nScoreLimit = int32_t(get(4));
+        rules.fAISpeed = getf();
+        rules.fAIFireDelay = getf();
+        rules.nTanks = (nFileVersion >= 3) ? int(get(1)) : 2;
+        rules.nBulletsPerTank = (nFileVersion >= 3) ? int(get(1)) : 1;
+        if (rules.nTanks < 2 || rules.nTanks > CombatState::nMaxTanks || rules.nBulletsPerTank < 1 || rules.nBulletsPerTank > CombatState::nMaxBulletsPerTank)
+            return false;
+        uint32_t nTicks = uint32_t(get(4));
+        nFinalHash = get(8);
+        if (nFileVersion < 4)
+            nFinalHash = 0;
+        if (!bOk)
+            return false;
+
+        vInputs.clear();
+        while (vInputs.size() < nTicks && bOk) {
+            uint16_t nMask = uint16_t(get(rules.bTwoPlayer ? 2 : 1));
+            uint64_t nRun = 0;
+            for (int nShift = 0; bOk && nShift < 35; nShift += 7) {
+                uint8_t b = uint8_t(get(1));
+                nRun |= uint64_t(b & 0x7F) << nShift;
+                if (!(b & 0x80)) break;
+            }
+            if (nRun == 0 || nRun > nTicks - vInputs.size())
+                return false;
+            vInputs.insert(vInputs.end(), size_t(nRun), nMask);
+        }
+        return bOk && nPos == v.size();
+    }
+};
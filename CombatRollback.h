@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "CombatSim.h"
+
+// GGPO-style rollback for a two-player match split across two machines.
+// Each side runs its own session: the local player's input is simulated
+// straight away, and the remote player's is predicted (their last known
+// keys, without fire) until it arrives. If it turns out to differ from the
+// prediction, the session restores the snapshot from before that tick and
+// resimulates up to the present with what it now knows, so both sides
+// converge on the same state. A snapshot is one CombatState copy, and a tick
+// has no side effects outside the sim, so resimulating costs only the ticks.
+//
+// Sending inputs is up to the caller: pass each local input to the other
+// side with the tick number Advance() was called at, and hand what arrives
+// from there to AddRemoteInput() in tick order.
+class CombatRollback
+{
+public:
+    static constexpr int nMaxPrediction = 8;    // Ticks the local side may run ahead of remote input
+
+    void Create(std::shared_ptr<const CombatBoard> pBoard, CombatRules rules, int nLocal)
+    {
+        rules.bTwoPlayer = true;
+        sim.Create(std::move(pBoard), rules);
+        nLocalPlayer = nLocal;
+        nRemoteKnown = 0;
+        nRollbackTo = -1;
+        nRollbacks = nResimTicks = nMaxResim = 0;
+    }
+
+    const CombatSim& Sim() const { return sim; }
+
+    // The tick the next Advance() simulates
+    int Tick() const { return sim.nTick; }
+
+    // False when the remote side has fallen too far behind to predict any further
+    bool CanAdvance() const { return sim.nTick - nRemoteKnown < nMaxPrediction; }
+
+    // Resimulates if a remote input proved a prediction wrong, then runs one
+    // tick with the local input. Returns false, without doing anything, when
+    // CanAdvance() is false; call again once more remote input has arrived.
+    bool Advance(const CombatInput& local)
+    {
+        Resimulate();
+        if (!CanAdvance())
+            return false;
+
+        Frame& f = aFrames[sim.nTick % nFrames];
+        f.state = sim.State();
+        f.aInputs[nLocalPlayer] = local.Bits();
+        f.aInputs[1 - nLocalPlayer] = RemoteInput(sim.nTick);
+        Step(f);
+        return true;
+    }
+
+    // The remote player's input for tick nTick; must arrive in tick order
+    void AddRemoteInput(int nTick, const CombatInput& input)
+    {
+        assert(nTick == nRemoteKnown && "Remote input out of order");
+        assert(nTick < sim.nTick + nRemoteSlots - nMaxPrediction && "Remote input too far ahead");
+        uint8_t nBits = input.Bits();
+        aRemote[nTick % nRemoteSlots] = nBits;
+        nRemoteKnown = nTick + 1;
+
+        // Already simulated on a guess: roll back if it was wrong
+        if (nTick < sim.nTick && aFrames[nTick % nFrames].aInputs[1 - nLocalPlayer] != nBits)
+            nRollbackTo = (nRollbackTo < 0) ? nTick : std::min(nRollbackTo, nTick);
+    }
+
+    // Brings the present up to date with every remote input received so far
+    void Resimulate()
+    {
+        if (nRollbackTo < 0)
+            return;
+        int nNow = sim.nTick;
+        sim.Restore(aFrames[nRollbackTo % nFrames].state);
+        for (int t = nRollbackTo; t < nNow; t++) {
+            Frame& f = aFrames[t % nFrames];
+            f.state = sim.State();
+            f.aInputs[1 - nLocalPlayer] = RemoteInput(t);
+            Step(f);
+        }
+        nRollbacks++;
+        nResimTicks += nNow - nRollbackTo;
+        nMaxResim = std::max(nMaxResim, nNow - nRollbackTo);
+        nRollbackTo = -1;
+    }
+
+    // Rollbacks done, ticks resimulated in total and in the longest one
+    long long nRollbacks = 0, nResimTicks = 0;
+    int nMaxResim = 0;
+
+private:
+    // The state before a tick and the inputs it was run with
+    struct Frame
+    {
+        CombatState state;
+        std::array<uint8_t, 2> aInputs = {};
+    };
+    static constexpr int nFrames = nMaxPrediction + 1;
+    static constexpr int nRemoteSlots = 2 * nFrames;
+
+    CombatSim sim;
+    std::array<Frame, nFrames> aFrames;
+    std::array<uint8_t, nRemoteSlots> aRemote = {};
+    int nLocalPlayer = 0;
+    int nRemoteKnown = 0;       // Remote input has arrived for every tick before this
+    int nRollbackTo = -1;       // Earliest mispredicted tick, or -1
+
+    // Known input, or a guess: the last known keys held, fire not repeated
+    uint8_t RemoteInput(int nTick) const
+    {
+        if (nTick < nRemoteKnown)
+            return aRemote[nTick % nRemoteSlots];
+        if (nRemoteKnown == 0)
+            return 0;
+        return uint8_t(aRemote[(nRemoteKnown - 1) % nRemoteSlots] & ~CombatInput::BIT_FIRE);
+    }
+
+    void Step(const Frame& f)
+    {
+        sim.Tick(CombatInput::FromBits(f.aInputs[0]), CombatInput::FromBits(f.aInputs[1]));
+    }
+};
@@ -0,0 +1,1409 @@
+#pragma once
+/*
+    CombatSim.h - the Combat game world, without any window, renderer or input
+    device attached.
+
+    CombatSim owns the tanks (two in the original game, up to 64 in team
+    variants), their bullets and the timers that drive spinning and firing,
+    kept together in a plain CombatState so they can be snapshotted, and
+    plays on a shared, immutable CombatBoard. It is advanced one fixed step
+    at a time by Tick() from an explicit CombatInput, so the same code runs
+    the windowed game (Combat.cpp feeds it from GetKey and draws the result)
+    and headless matches for bot evaluation (build Combat.cpp with
+    COMBAT_HEADLESS).
+
+    Only olc::vf2d is used from olcPixelGameEngine.h; nothing here needs
+    OLC_PGE_APPLICATION to be defined.
+*/
+#include "olcPixelGameEngine.h"
+#include <cmath>
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+#undef min
+#undef max
+#include "olcAABB.h"
+#include "CombatProfiler.h"
+#include "CombatFlow.h"
+#include "CombatPath.h"
+#include "CombatSight.h"
+
+#ifndef PI
+#define PI 3.14159265
+#endif
+
+
+// The walls of a board, in every form the sweep needs. A board is compiled
+// once and never modified afterwards, so a single instance can be shared
+// read-only by any number of CombatSims, on any number of threads.
+//
+// Boards come from FromText() or, compiled ahead, from CombatMapFile (see
+// CombatMap.h). The text form is a "combat-map" line, a "size W H TILE"
+// line, any number of "spawn red|blue X Y" lines (in pixels, in tank order
+// within each team), then H rows of W tiles, '#' for a wall and '.' for
+// open floor. Lines starting with ';' are comments.
+//
+// Boards more than nStreamTiles across are streamed: nothing is merged up
+// front, and the walls come a chunk of nChunkTiles square at a time from
+// ChunkRects(), for whichever chunks a WallStream has been asked for. That
+// bounds the merged walls and the work of sweeping them, not the board:
+// sBoard is held whole, a wchar_t per tile, and the AI modes' FlowField,
+// PathService and SightGrid each keep arrays over every tile of it too.
+struct CombatBoard
+{
+    using Spawns = std::array<std::vector<olc::vf2d>, 2>;
+
+    static constexpr int nStreamTiles = 128;
+    static constexpr int nChunkTiles = 32;
+    static constexpr int nMaxPixels = 32767;    // Across and down; deterministic mode holds positions in Q16.16
+    static constexpr int nTankPixels = 8;       // A tank's side, which a spawn must have room for
+
+    // Tiles on a side of a FlowField or PathService cell: a tank and a tile of
+    // slack, so a tank with its corner anywhere in an open cell is clear of
+    // the walls. CombatBoardGen checks routes with the same.
+    static int FlowTiles(int nSquareSize) { return (nTankPixels + nSquareSize - 1) / nSquareSize + 1; }
+
+    std::wstring sBoard;
+    int nBoardWidth = 0;
+    int nBoardHeight = 0;
+    int nSquareSize = 0;
+    int nBoardTiles = 0;                    // '#' tiles in sBoard, before merging into vRects
+    uint64_t nHash = 0;                     // Identifies the layout, e.g. in replays; see Hash()
+    Spawns vSpawns;                         // Per team; none means the original game's spots
+    bool bStreamed = false;                 // Walls by the chunk; vRects, wallGrid and wallSoA stay empty
+    int nChunksX = 0, nChunksY = 0;         // Chunks across and down, streamed or not
+    std::vector<olc::aabb::rect> vRects;
+    olc::aabb::grid wallGrid;              // Broadphase over vRects
+    olc::aabb::rect_soa wallSoA;           // vRects laid out for olc::aabb::SweepRects
+
+    // pRects, if given, are the merged walls from an earlier MergeTiles() of
+    // the same tiles, and save doing it again
+    static std::shared_ptr<const CombatBoard> Compile(const std::wstring& sBoard, int nWidth, int nHeight, int nSquareSize,
+        const Spawns& vSpawns = {}, const std::vector<olc::aabb::rect>* pRects = nullptr)
+    {
+        auto board = std::make_shared<CombatBoard>();
+        board->sBoard = sBoard;
+        board->nBoardWidth = nWidth;
+        board->nBoardHeight = nHeight;
+        board->nSquareSize = nSquareSize;
+        board->nBoardTiles = int(std::count(sBoard.begin(), sBoard.end(), L'#'));
+        board->vSpawns = vSpawns;
+        board->nHash = Hash(sBoard, nWidth, nHeight, nSquareSize, vSpawns);
+        board->bStreamed = nWidth > nStreamTiles || nHeight > nStreamTiles;
+        board->nChunksX = (nWidth + nChunkTiles - 1) / nChunkTiles;
+        board->nChunksY = (nHeight + nChunkTiles - 1) / nChunkTiles;
+        if (board->bStreamed)
+            return board;
+
+        //Merge Board tiles into as few wall rects as possible
+        board->vRects = pRects ? *pRects : MergeTiles(sBoard, nWidth, nHeight, nSquareSize);
+        board->wallGrid.Build(board->vRects, float(nSquareSize), nWidth, nHeight);
+        board->wallSoA.Build(board->vRects);
+        return board;
+    }
+
+    // Parses and compiles the text form; null, with the reason in *pError if
+    // given, when it isn't a valid board
+    static std::shared_ptr<const CombatBoard> FromText(const std::string& sText, std::string* pError = nullptr)
+    {
+        auto fail = [&](const std::string& sWhy) {
+            if (pError) *pError = sWhy;
+            return std::shared_ptr<const CombatBoard>();
+        };
+        std::istringstream in(sText);
+        std::string sLine;
+        int nWidth = 0, nHeight = 0, nSquare = 0, nRows = 0;
+        bool bMagic = false;
+        Spawns vSpawns;
+        std::wstring sBoard;
+        while (std::getline(in, sLine)) {
+            if (!sLine.empty() && sLine.back() == '\r')
+                sLine.pop_back();
+            if (sLine.empty() || sLine[0] == ';')
+                continue;
+            std::istringstream ls(sLine);
+            std::string sKey;
+            ls >> sKey;
+            if (!bMagic) {
+                if (sKey != "combat-map")
+                    return fail("not a combat-map file");
+                bMagic = true;
+            }
+            else if (sKey == "size" && nRows == 0) {
+                if (!(ls >> nWidth >> nHeight >> nSquare) || nWidth < 1 || nHeight < 1 || nSquare < 1 || nWidth > 4096 || nHeight > 4096 || nSquare > 64)
+                    return fail("bad size line: " + sLine);
+                std::string sWhy = Problem(L"", nWidth, nHeight, nSquare);
+                if (!sWhy.empty())
+                    return fail(sWhy);
+            }
+            else if (sKey == "spawn" && nRows == 0) {
+                std::string sTeam;
+                int x = 0, y = 0;
+                if (!(ls >> sTeam >> x >> y) || (sTeam != "red" && sTeam != "blue") || x < 0 || y < 0 || x > 65535 || y > 65535)
+                    return fail("bad spawn line: " + sLine);
+                if (vSpawns[sTeam == "blue"].size() == 255)
+                    return fail("more than 255 spawns for " + sTeam);
+                vSpawns[sTeam == "blue"].push_back({ float(x), float(y) });
+            }
+            else {
+                if (nWidth == 0)
+                    return fail("tiles before the size line");
+                if (int(sLine.size()) != nWidth || sLine.find_first_not_of("#.") != std::string::npos || nRows == nHeight)
+                    return fail("bad tile row " + std::to_string(nRows + 1) + ": " + sLine);
+                sBoard.append(sLine.begin(), sLine.end());
+                nRows++;
+            }
+        }
+        if (nRows != nHeight || nWidth == 0)
+            return fail("expected " + std::to_string(nHeight) + " tile rows, found " + std::to_string(nRows));
+        std::string sWhy = Problem(sBoard, nWidth, nHeight, nSquare, vSpawns);
+        if (!sWhy.empty())
+            return fail(sWhy);
+        return Compile(sBoard, nWidth, nHeight, nSquare, vSpawns);
+    }
+
+    // Why a board can't be played, or empty if it can: more than nMaxPixels
+    // across or down, so fx::FromFloat() would wrap a position, or a spawn
+    // that puts a tank off the board or in a wall. Without sBoard only the
+    // size is checked, so a loader can turn a board down before reading it.
+    static std::string Problem(const std::wstring& sBoard, int nWidth, int nHeight, int nSquareSize, const Spawns& vSpawns = {})
+    {
+        if (int64_t(nWidth) * nSquareSize > nMaxPixels || int64_t(nHeight) * nSquareSize > nMaxPixels)
+            return "board is more than " + std::to_string(nMaxPixels) + " pixels across or down";
+        if (sBoard.empty())
+            return "";
+        for (int t = 0; t < 2; t++)
+            for (const olc::vf2d& v : vSpawns[t]) {
+                std::string sSpawn = std::string(t ? "blue" : "red") + " spawn " + std::to_string(int(v.x)) + " " + std::to_string(int(v.y));
+                olc::aabb::rect tank = { v, { float(nTankPixels), float(nTankPixels) } };
+                if (v.x + nTankPixels > float(nWidth * nSquareSize) || v.y + nTankPixels > float(nHeight * nSquareSize))
+                    return sSpawn + " is off the board";
+                if (AnyWall(sBoard, nWidth, nHeight, nSquareSize, tank))
+                    return sSpawn + " is in a wall";
+            }
+        return "";
+    }
+
+    // The text form of this board, which FromText() reads back as the same board
+    std::string ToText() const
+    {
+        std::string s = "combat-map\nsize " + std::to_string(nBoardWidth) + " " + std::to_string(nBoardHeight) + " " + std::to_string(nSquareSize) + "\n";
+        for (int t = 0; t < 2; t++)
+            for (const olc::vf2d& v : vSpawns[t])
+                s += std::string("spawn ") + (t ? "blue " : "red ") + std::to_string(int(v.x)) + " " + std::to_string(int(v.y)) + "\n";
+        for (int y = 0; y < nBoardHeight; y++) {
+            for (int x = 0; x < nBoardWidth; x++)
+                s += sBoard[y * nBoardWidth + x] == L'#' ? '#' : '.';
+            s += '\n';
+        }
+        return s;
+    }
+
+    // The original Atari Combat playfield, compiled on first use. Built in,
+    // so headless runs and replays never depend on finding a map file.
+    static std::shared_ptr<const CombatBoard> Default()
+    {
+        static std::shared_ptr<const CombatBoard> board = FromText(
+            "combat-map\n"
+            "size 47 34 4\n"
+            "...............................................\n"
+            "...............................................\n"
+            "...............................................\n"
+            "###############################################\n"
+            "#.....................###.....................#\n"
+            "#.....................###.....................#\n"
+            "#.....................###.....................#\n"
+            "#.............................................#\n"
+            "#......####.........................####......#\n"
+            "#.............................................#\n"
+            "#.............................................#\n"
+            "#...............####.......####...............#\n"
+            "#...............##...........##...............#\n"
+            "#.....##...............................##.....#\n"
+            "#......#...............................#......#\n"
+            "#......#...............................#......#\n"
+            "#......#...............................#......#\n"
+            "#......#....##...................##....#......#\n"
+            "#......#....##...................##....#......#\n"
+            "#......#....##...................##....#......#\n"
+            "#......#...............................#......#\n"
+            "#......#...............................#......#\n"
+            "#.....##...............................##.....#\n"
+            "#.............................................#\n"
+            "#...............##...........##...............#\n"
+            "#...............####.......####...............#\n"
+            "#.............................................#\n"
+            "#.............................................#\n"
+            "#......####.........................####......#\n"
+            "#.............................................#\n"
+            "#.....................###.....................#\n"
+            "#.....................###.....................#\n"
+            "#.....................###.....................#\n"
+            "###############################################\n");
+        return board;
+    }
+
+    olc::vf2d PixelSize() const { return olc::vf2d{ float(nBoardWidth), float(nBoardHeight) } * float(nSquareSize); }
+
+    // Chunk nChunk's walls, merged as MergeTiles() does but split at the chunk's edges
+    std::vector<olc::aabb::rect> ChunkRects(int nChunk) const
+    {
+        return MergeTiles(sBoard, nBoardWidth, nBoardHeight, nSquareSize, (nChunk % nChunksX) * nChunkTiles, (nChunk / nChunksX) * nChunkTiles, nChunkTiles, nChunkTiles);
+    }
+
+    // Whether r overlaps any wall tile, by more than a shared edge
+    bool AnyWall(const olc::aabb::rect& r) const { return AnyWall(sBoard, nBoardWidth, nBoardHeight, nSquareSize, r); }
+
+    static bool AnyWall(const std::wstring& sBoard, int nWidth, int nHeight, int nSquareSize, const olc::aabb::rect& r)
+    {
+        int x0 = std::max(int(std::floor(r.pos.x / nSquareSize)), 0), x1 = std::min(int(std::ceil((r.pos.x + r.size.x) / nSquareSize)), nWidth);
+        int y0 = std::max(int(std::floor(r.pos.y / nSquareSize)), 0), y1 = std::min(int(std::ceil((r.pos.y + r.size.y) / nSquareSize)), nHeight);
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                if (sBoard[size_t(y) * nWidth + x] == L'#')
+                    return true;
+        return false;
+    }
+
+    // FNV-1a over the dimensions, tiles and any spawns, the same wherever
+    // wchar_t is 16 or 32 bits. A board without spawns hashes as it did
+    // before they existed.
+    static uint64_t Hash(const std::wstring& sBoard, int nWidth, int nHeight, int nSquareSize, const Spawns& vSpawns = {})
+    {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&](uint32_t n, int nBytes) {
+            for (int i = 0; i < nBytes; i++) { h ^= (n >> (8 * i)) & 0xFF; h *= 1099511628211ull; }
+        };
+        mix(uint32_t(nWidth), 4); mix(uint32_t(nHeight), 4); mix(uint32_t(nSquareSize), 4);
+        for (wchar_t c : sBoard)
+            mix(uint32_t(c), 2);
+        if (!vSpawns[0].empty() || !vSpawns[1].empty())
+            for (const std::vector<olc::vf2d>& v : vSpawns) {
+                mix(uint32_t(v.size()), 2);
+                for (const olc::vf2d& p : v) {
+                    mix(uint32_t(p.x), 2); mix(uint32_t(p.y), 2);
+                }
+            }
+        return h;
+    }
+
+    // Turns the '#' tiles of a board into axis-aligned wall rects. Each row is
+    // split into runs of consecutive tiles, and a run is merged into the rect
+    // above it when that rect spans exactly the same columns, so solid blocks
+    // and long walls become a single rect each. Given nCols and nRows, only
+    // the tiles in that window from (nLeft, nTop) are merged.
+    static std::vector<olc::aabb::rect> MergeTiles(const std::wstring& sBoard, int nWidth, int nHeight, int nSquareSize,
+        int nLeft = 0, int nTop = 0, int nCols = 0, int nRows = 0)
+    {
+        int nRight = nCols ? std::min(nLeft + nCols, nWidth) : nWidth, nBottom = nRows ? std::min(nTop + nRows, nHeight) : nHeight;
+        std::vector<olc::aabb::rect> vOut;
+        std::vector<int> vOpen(nWidth, -1), vNextOpen(nWidth, -1);   // Rect index of the run starting at column x in the row above
+
+        for (int y = nTop; y < nBottom; y++) {
+            std::fill(vNextOpen.begin(), vNextOpen.end(), -1);
+            for (int x = nLeft; x < nRight; ) {
+                if (sBoard[y * nWidth + x] != '#') { x++; continue; }
+                int x0 = x;
+                while (x < nRight && sBoard[y * nWidth + x] == '#') x++;
+
+                int n = vOpen[x0];
+                if (n >= 0 && vOut[n].size.x == float((x - x0) * nSquareSize))
+                    vOut[n].size.y += float(nSquareSize);
+                else {
+                    n = int(vOut.size());
+                    vOut.push_back({ {float(x0 * nSquareSize), float(y * nSquareSize)}, {float((x - x0) * nSquareSize), float(nSquareSize)} });
+                }
+                vNextOpen[x0] = n;
+            }
+            std::swap(vOpen, vNextOpen);
+        }
+        return vOut;
+    }
+};
+
+
+// The chunks of a streamed board that something is near, each merged into
+// wall rects with a grid and rect_soa of its own. Want() every area of
+// interest, then Commit(): chunks no longer wanted are dropped and new ones
+// merged, so the merged walls, and the work of merging and sweeping them,
+// follow the areas asked for rather than the size of the board. What's
+// resident depends only on what was last asked for, so a sim that asks for
+// the space around its tanks and bullets collides the same way after a
+// Restore() as it did the first time.
+class WallStream
+{
+public:
+    struct Chunk
+    {
+        int nId = 0;                        // y * nChunksX + x
+        int nFirst = 0;                     // Of its rects in vRects
+        olc::vf2d vMin, vMax;               // Pixel bounds
+        std::vector<olc::aabb::rect> vRects;
+        olc::aabb::grid wallGrid;
+        olc::aabb::rect_soa wallSoA;
+    };
+
+    std::vector<std::unique_ptr<Chunk>> vChunks;   // Resident, by id
+    std::vector<olc::aabb::rect> vRects;            // Every resident chunk's, in chunk order; wall handles index this
+    int nMerged = 0;                                // Chunks merged since Reset(), counting re-merges
+
+    void Reset(const CombatBoard* pStreamed)
+    {
+        pBoard = pStreamed;
+        vChunks.clear();
+        vRects.clear();
+        vWanted.clear();
+        nMerged = 0;
+    }
+
+    // The chunks under the pixel box [tl, br]
+    void Want(const olc::vf2d& tl, const olc::vf2d& br)
+    {
+        int x0, y0, x1, y1;
+        if (ChunkRange(tl, br, x0, y0, x1, y1))
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++)
+                    vWanted.push_back(y * pBoard->nChunksX + x);
+    }
+
+    // Makes exactly the chunks wanted since the last Commit resident; true if that changed anything
+    bool Commit()
+    {
+        std::sort(vWanted.begin(), vWanted.end());
+        vWanted.erase(std::unique(vWanted.begin(), vWanted.end()), vWanted.end());
+        bool bSame = vWanted.size() == vChunks.size();
+        for (size_t i = 0; bSame && i < vWanted.size(); i++)
+            bSame = vChunks[i]->nId == vWanted[i];
+        if (bSame) {
+            vWanted.clear();
+            return false;
+        }
+
+        TraceRecorder::Scope trace("stream walls");
+        std::vector<std::unique_ptr<Chunk>> vOld = std::move(vChunks);
+        vChunks.clear();
+        vRects.clear();
+        size_t nOld = 0;
+        for (int nId : vWanted) {
+            while (nOld < vOld.size() && vOld[nOld]->nId < nId)
+                nOld++;
+            std::unique_ptr<Chunk> c = (nOld < vOld.size() && vOld[nOld]->nId == nId) ? std::move(vOld[nOld++]) : Merge(nId);
+            c->nFirst = int(vRects.size());
+            vRects.insert(vRects.end(), c->vRects.begin(), c->vRects.end());
+            vChunks.push_back(std::move(c));
+        }
+        assert(vRects.size() <= 0xFFFF && "Too many resident walls for a handle");
+        vWanted.clear();
+        return true;
+    }
+
+    // Calls f(chunk) for every resident chunk under the pixel box [tl, br], in id order
+    template<typename F>
+    void Query(const olc::vf2d& tl, const olc::vf2d& br, F&& f) const
+    {
+        int x0, y0, x1, y1;
+        if (!ChunkRange(tl, br, x0, y0, x1, y1))
+            return;
+        for (int y = y0; y <= y1; y++) {
+            auto it = std::lower_bound(vChunks.begin(), vChunks.end(), y * pBoard->nChunksX + x0, [](const std::unique_ptr<Chunk>& c, int n) { return c->nId < n; });
+            for (; it != vChunks.end() && (*it)->nId <= y * pBoard->nChunksX + x1; ++it)
+                f(**it);
+        }
+    }
+
+private:
+    const CombatBoard* pBoard = nullptr;
+    std::vector<int> vWanted;
+
+    bool ChunkRange(const olc::vf2d& tl, const olc::vf2d& br, int& x0, int& y0, int& x1, int& y1) const
+    {
+        float fChunk = float(CombatBoard::nChunkTiles * pBoard->nSquareSize);
+        x0 = std::max(int(std::floor(tl.x / fChunk)), 0);
+        y0 = std::max(int(std::floor(tl.y / fChunk)), 0);
+        x1 = std::min(int(std::floor(br.x / fChunk)), pBoard->nChunksX - 1);
+        y1 = std::min(int(std::floor(br.y / fChunk)), pBoard->nChunksY - 1);
+        return x0 <= x1 && y0 <= y1;
+    }
+
+    std::unique_ptr<Chunk> Merge(int nId)
+    {
+        auto c = std::make_unique<Chunk>();
+        float fChunk = float(CombatBoard::nChunkTiles * pBoard->nSquareSize);
+        c->nId = nId;
+        c->vMin = olc::vf2d{ float(nId % pBoard->nChunksX), float(nId / pBoard->nChunksX) } * fChunk;
+        c->vMax = c->vMin + olc::vf2d{ fChunk, fChunk };
+        c->vRects = pBoard->ChunkRects(nId);
+        c->wallGrid.Build(c->vRects, float(pBoard->nSquareSize), CombatBoard::nChunkTiles, CombatBoard::nChunkTiles, c->vMin);
+        c->wallSoA.Build(c->vRects);
+        nMerged++;
+        return c;
+    }
+};
+
+
+// Everything a sweep can hit is named by an entity handle: the kind in the
+// high bits and the index within that kind in the low 16. Walls are kind 0,
+// so a wall's handle is its index in CombatBoard::vRects, exactly as
+// olc::aabb::SweepRects reports it, or on a streamed board in the sim's
+// WallStream::vRects.
+enum EntityKind { ENTITY_WALL = 0, ENTITY_TANK = 1, ENTITY_BULLET = 2 };
+inline int EntityHandle(EntityKind kind, int index) { return (int(kind) << 16) | index; }
+inline EntityKind HandleKind(int handle) { return EntityKind(handle >> 16); }
+inline int HandleIndex(int handle) { return handle & 0xFFFF; }
+
+
+// Q16.16 fixed point, used by CombatSim's deterministic mode
+namespace fx
+{
+    constexpr int32_t ONE = 1 << 16;
+
+    inline int32_t FromFloat(float f) { return int32_t(std::lround(double(f) * ONE)); }
+    inline float ToFloat(int32_t v) { return float(v) / float(ONE); }
+    inline int32_t Mul(int32_t a, int32_t b) { return int32_t((int64_t(a) * b) >> 16); }
+
+    inline olc::vi2d FromFloat(const olc::vf2d& v) { return { FromFloat(v.x), FromFloat(v.y) }; }
+    inline olc::vf2d ToFloat(const olc::vi2d& v) { return { ToFloat(v.x), ToFloat(v.y) }; }
+
+    // cos/sin of the 16 tank headings, i * PI/8, rounded to Q16.16
+    constexpr int32_t aHeading[16][2] = {
+        { 65536, 0 }, { 60547, 25080 }, { 46341, 46341 }, { 25080, 60547 },
+        { 0, 65536 }, { -25080, 60547 }, { -46341, 46341 }, { -60547, 25080 },
+        { -65536, 0 }, { -60547, -25080 }, { -46341, -46341 }, { -25080, -60547 },
+        { 0, -65536 }, { 25080, -60547 }, { 46341, -46341 }, { 60547, -25080 },
+    };
+}
+
+
+// Everything the player (or a bot standing in for them) can do in one tick
+struct CombatInput
+{
+    bool bUp = false;
+    bool bDown = false;
+    bool bLeft = false;
+    bool bRight = false;
+    bool bFire = false;     // Edge triggered - fires once per tick it is set
+
+    // One bit per key, as replays store it
+    enum : uint8_t { BIT_UP = 1, BIT_DOWN = 2, BIT_LEFT = 4, BIT_RIGHT = 8, BIT_FIRE = 16 };
+
+    uint8_t Bits() const
+    {
+        return uint8_t((bUp ? BIT_UP : 0) | (bDown ? BIT_DOWN : 0) | (bLeft ? BIT_LEFT : 0) | (bRight ? BIT_RIGHT : 0) | (bFire ? BIT_FIRE : 0));
+    }
+
+    static CombatInput FromBits(uint8_t n)
+    {
+        CombatInput in;
+        in.bUp = n & BIT_UP; in.bDown = n & BIT_DOWN; in.bLeft = n & BIT_LEFT; in.bRight = n & BIT_RIGHT; in.bFire = n & BIT_FIRE;
+        return in;
+    }
+};
+
+// Settings fixed for the length of a match
+struct CombatRules
+{
+    // Deterministic mode gives bit-identical matches on any compiler and
+    // platform with IEEE single precision floats (x86-64, WASM; not x87, and
+    // not with -ffast-math or /fp:fast). Headings come from the fixed-point
+    // table in fx instead of cosf/sinf, and every position, velocity and
+    // collision response is kept on the Q16.16 grid with the arithmetic done
+    // in integers, so none of that depends on libm. The sweeps stay in
+    // float, and aren't exact: from 256 px on, a Q16.16 position has more
+    // bits than a float's 24-bit mantissa. They come out the same everywhere
+    // because they only use +, -, *, / and comparisons, which IEEE rounds
+    // correctly, provided the compiler never contracts a multiply and an add
+    // into one fused operation. The builds pin that: -ffp-contract=off for
+    // g++, clang and em++, and /fp:precise without /fp:contract for MSVC.
+    bool bDeterministic = false;
+    int nScoreLimit = 0;        // First tank to this many hits ends the match; 0 plays the full clock
+    float fAISpeed = 3;         // AI tank drive speed (whole numbers in deterministic mode)
+    float fAIFireDelay = 5;     // Seconds between AI shots
+    bool bTwoPlayer = false;    // Tank 1 takes the second player's input instead of the AI's
+    bool bFlowAI = false;       // AI tanks follow a FlowField to the nearest enemy instead of turning away from whatever they hit
+    bool bPathAI = false;       // AI tanks follow an A* path to the nearest enemy instead; wins over bFlowAI
+    bool bSightAI = false;      // AI tanks hold their fire until a shot would hit an enemy before a wall
+    int nTanks = 2;             // 2 to CombatState::nMaxTanks; even tanks are the red team, odd ones blue
+    int nBulletsPerTank = 1;    // Shots a tank can have in flight, 1 to CombatState::nMaxBulletsPerTank; past it, firing recycles the oldest
+
+    // Why these rules can't be played on board, or empty if they can. A sim
+    // given such a board anyway has AI that finds no paths.
+    std::string Problem(const CombatBoard& board) const
+    {
+        if (bPathAI && !PathService::Fits(board.nBoardWidth, board.nBoardHeight))
+            return "path AI takes boards of at most " + std::to_string(PathService::nMaxCells) + " tiles";
+        return "";
+    }
+};
+
+
+// Everything about a match that changes as it is played, in one trivially
+// copyable block: taking a snapshot is a plain copy and restoring one is an
+// assignment, some 14KB either way. The board stays out, being immutable and
+// shared; nBoardHash says which one the state belongs to. Save/Load give a
+// versioned, portable on-disk form.
+//
+// Tanks are stored as a structure-of-arrays table, so the sweep and AI loops
+// walk each field linearly, and bullets live in a fixed pool shared by all
+// of them. Tank 0 is the first player's, tank 1 the second player's or the
+// AI's, and any others are AI; the original game is simply the two-tank,
+// one-bullet configuration.
+struct CombatState
+{
+    static constexpr int nMaxTanks = 64;
+    static constexpr int nMaxBulletsPerTank = 16;
+    static constexpr int nMaxBullets = 512;             // In flight at once, across every tank
+
+    enum : uint8_t
+    {
+        TANK_ARMED = 1,         // May fire, and its shots move; cleared for AI tanks while play is paused after a hit
+        TANK_SPINNING = 2,      // Was hit; spins out until play resumes
+        TANK_BLOCKED = 4,       // AI only: ran into something last tick, so turns away
+    };
+
+    // Every tank in the match, one array per field, indexed by tank
+    struct TankTable
+    {
+        int nCount = 0;
+        std::array<olc::vf2d, nMaxTanks> aPos, aVel;
+        std::array<float, nMaxTanks> aAng;
+        std::array<int, nMaxTanks> aHeading;            // Rotational position, 0-15
+        std::array<int, nMaxTanks> aScore;              // Wraps at 100, as on the Atari
+        std::array<int, nMaxTanks> aShots, aHits;       // Match totals
+        std::array<uint8_t, nMaxTanks> aFlags;
+    };
+
+    // Every bullet in flight, in nMaxBullets fixed slots. Free slots are kept
+    // on a stack, so a spawn or despawn is a push and a pop, never a search
+    // or an allocation. Each tank lists its own live slots oldest first: the
+    // loops walk only those, in tank order as the original game did, and the
+    // shot to recycle is always at the front. Slot numbers mean nothing
+    // outside the pool; saves and hashes go by tank and age.
+    struct BulletPool
+    {
+        std::array<olc::vf2d, nMaxBullets> aPos, aVel;
+        std::array<int16_t, nMaxBullets> aFree;                             // Free slots, next one to use last
+        int nFree = 0;
+        std::array<std::array<int16_t, nMaxBulletsPerTank>, nMaxTanks> aShots;  // Per tank, its live slots oldest first
+        std::array<uint8_t, nMaxTanks> aCount;
+
+        // Empties the pool; slot 0 is handed out first
+        void Reset()
+        {
+            for (int i = 0; i < nMaxBullets; i++)
+                aFree[i] = int16_t(nMaxBullets - 1 - i);
+            nFree = nMaxBullets;
+            aCount = {};
+        }
+
+        int Count(int nTank) const { return aCount[nTank]; }
+        int Slot(int nTank, int n) const { return aShots[nTank][n]; }     // Tank's n-th oldest shot
+        int Live() const { return nMaxBullets - nFree; }
+
+        // Puts a new shot at the back of nTank's list; -1 if the pool or the tank is full
+        int Spawn(int nTank, const olc::vf2d& pos, const olc::vf2d& vel)
+        {
+            if (nFree == 0 || aCount[nTank] == nMaxBulletsPerTank)
+                return -1;
+            int s = aFree[--nFree];
+            aPos[s] = pos;
+            aVel[s] = vel;
+            aShots[nTank][aCount[nTank]++] = int16_t(s);
+            return s;
+        }
+
+        // Returns nTank's n-th oldest shot to the pool; younger ones move up one
+        void Despawn(int nTank, int n)
+        {
+            std::array<int16_t, nMaxBulletsPerTank>& shots = aShots[nTank];
+            aFree[nFree++] = shots[n];
+            std::copy(shots.begin() + n + 1, shots.begin() + aCount[nTank], shots.begin() + n);
+            aCount[nTank]--;
+        }
+    };
+
+    static inline const olc::vf2d vTankSize = { float(CombatBoard::nTankPixels), float(CombatBoard::nTankPixels) };
+    static inline const olc::vf2d vBulletSize = { 1, 1 };
+
+    TankTable tanks = {};
+    BulletPool bullets = {};
+    CombatRules rules;
+    uint64_t nBoardHash = 0;
+    float fAccumTime = 0;
+    int nTick = 0;
+
+    static int Team(int nTank) { return nTank % 2; }
+    bool HasFlag(int nTank, uint8_t nFlag) const { return (tanks.aFlags[nTank] & nFlag) != 0; }
+    void SetFlag(int nTank, uint8_t nFlag, bool b) { tanks.aFlags[nTank] = uint8_t(b ? (tanks.aFlags[nTank] | nFlag) : (tanks.aFlags[nTank] & ~nFlag)); }
+
+    // Player 0 or 1 for a tank driven by input, -1 for the AI
+    int Player(int nTank) const { return nTank == 0 ? 0 : (nTank == 1 && rules.bTwoPlayer) ? 1 : -1; }
+
+    // Sum over a team's tanks; for two tanks, that tank's own figure
+    int TeamTotal(const std::array<int, nMaxTanks>& aField, int nTeam) const
+    {
+        int n = 0;
+        for (int i = nTeam; i < tanks.nCount; i += 2)
+            n += aField[i];
+        return n;
+    }
+
+    static constexpr uint32_t nMagic = 0x53424D43;     // "CMBS"
+    static constexpr uint16_t nVersion = 7;             // 2: rules.bTwoPlayer; 3: tank and bullet tables; 4: live bullets only; 5: rules.bFlowAI; 6: rules.bPathAI; 7: rules.bSightAI
+
+    // Little-endian, field by field
+    bool Save(const std::string& sFile) const
+    {
+        std::vector<uint8_t> v;
+        auto put = [&](uint64_t n, int nBytes) { for (int i = 0; i < nBytes; i++) v.push_back(uint8_t(n >> (8 * i))); };
+        auto putf = [&](float f) { uint32_t n; std::memcpy(&n, &f, 4); put(n, 4); };
+        auto putv = [&](const olc::vf2d& vec) { putf(vec.x); putf(vec.y); };
+
+        put(nMagic, 4); put(nVersion, 2);
+        put(rules.bDeterministic | (rules.bTwoPlayer << 1) | (rules.bFlowAI << 2) | (rules.bPathAI << 3) | (rules.bSightAI << 4), 1); put(uint32_t(rules.nScoreLimit), 4); putf(rules.fAISpeed); putf(rules.fAIFireDelay);
+        put(uint32_t(rules.nTanks), 1); put(uint32_t(rules.nBulletsPerTank), 1);
+        put(nBoardHash, 8); putf(fAccumTime); put(uint32_t(nTick), 4);
+        for (int i = 0; i < tanks.nCount; i++) {
+            putv(tanks.aPos[i]); putv(tanks.aVel[i]); putf(tanks.aAng[i]); put(uint32_t(tanks.aHeading[i]), 1);
+            put(uint32_t(tanks.aScore[i]), 4); put(uint32_t(tanks.aShots[i]), 4); put(uint32_t(tanks.aHits[i]), 4);
+            put(tanks.aFlags[i], 1); put(uint32_t(bullets.Count(i)), 1);
+            for (int n = 0; n < bullets.Count(i); n++) {
+                putv(bullets.aPos[bullets.Slot(i, n)]); putv(bullets.aVel[bullets.Slot(i, n)]);
+            }
+        }
+
+        std::ofstream f(sFile, std::ios::binary);
+        f.write(reinterpret_cast<const char*>(v.data()), std::streamsize(v.size()));
+        return bool(f);
+    }
+
+    // Also reads the older versions: 1 and 2 always held the two-tank game,
+    // and up to 3 a bullet slot with zero velocity held no shot
+    bool Load(const std::string& sFile)
+    {
+        std::ifstream f(sFile, std::ios::binary);
+        if (!f)
+            return false;
+        std::vector<uint8_t> v((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+        size_t nPos = 0;
+        bool bOk = true;
+        auto get = [&](int nBytes) {
+            uint64_t n = 0;
+            if (nPos + nBytes > v.size()) { bOk = false; return n; }
+            for (int i = 0; i < nBytes; i++) n |= uint64_t(v[nPos++]) << (8 * i);
+            return n;
+        };
+        auto geti = [&]() { return int32_t(uint32_t(get(4))); };
+        auto getf = [&]() { uint32_t n = uint32_t(get(4)); float fv; std::memcpy(&fv, &n, 4); return fv; };
+        auto getv = [&](olc::vf2d& vec) { vec.x = getf(); vec.y = getf(); };
+        auto getrules = [&](CombatRules& rl) {
+            uint8_t nFlags = uint8_t(get(1));
+            rl.bDeterministic = nFlags & 1; rl.bTwoPlayer = nFlags & 2; rl.bFlowAI = nFlags & 4; rl.bPathAI = nFlags & 8; rl.bSightAI = nFlags & 16;
+            rl.nScoreLimit = geti(); rl.fAISpeed = getf(); rl.fAIFireDelay = getf();
+        };
+
+        uint32_t nFileMagic = uint32_t(get(4));
+        uint16_t nFileVersion = uint16_t(get(2));
+        if (nFileMagic != nMagic || nFileVersion < 1 || nFileVersion > nVersion || !bOk)
+            return false;
+        CombatState s;
+        s.bullets.Reset();
+        if (nFileVersion < 3) {
+            // myTank then otherTank, each with its one bullet, then the rest
+            s.tanks.nCount = 2;
+            for (int i = 0; i < 2; i++) {
+                olc::vf2d vSize, vBulletPos, vBulletVel;
+                s.tanks.aAng[i] = getf();
+                bool bArmed = get(1) != 0, bSpinning = get(1) != 0;
+                s.tanks.aFlags[i] = uint8_t((bArmed ? TANK_ARMED : 0) | (bSpinning ? TANK_SPINNING : 0));
+                s.tanks.aScore[i] = geti(); s.tanks.aShots[i] = geti(); s.tanks.aHits[i] = geti();
+                getv(vBulletPos); getv(vSize); getv(vBulletVel);
+                if (vBulletVel.x != 0 || vBulletVel.y != 0)
+                    s.bullets.Spawn(i, vBulletPos, vBulletVel);
+                getv(s.tanks.aPos[i]); getv(vSize); getv(s.tanks.aVel[i]);
+            }
+            getrules(s.rules);
+            s.nBoardHash = get(8); get(1);
+            s.SetFlag(1, TANK_BLOCKED, get(1) != 0);
+            s.fAccumTime = getf();
+            s.nTick = geti(); s.tanks.aHeading[0] = geti(); s.tanks.aHeading[1] = geti();
+        }
+        else {
+            getrules(s.rules);
+            s.rules.nTanks = int(get(1)); s.rules.nBulletsPerTank = int(get(1));
+            s.nBoardHash = get(8); s.fAccumTime = getf(); s.nTick = geti();
+            if (!bOk || s.rules.nTanks < 2 || s.rules.nTanks > nMaxTanks || s.rules.nBulletsPerTank < 1 || s.rules.nBulletsPerTank > nMaxBulletsPerTank)
+                return false;
+            s.tanks.nCount = s.rules.nTanks;
+            for (int i = 0; i < s.tanks.nCount; i++) {
+                getv(s.tanks.aPos[i]); getv(s.tanks.aVel[i]); s.tanks.aAng[i] = getf(); s.tanks.aHeading[i] = int(get(1));
+                s.tanks.aScore[i] = geti(); s.tanks.aShots[i] = geti(); s.tanks.aHits[i] = geti();
+                s.tanks.aFlags[i] = uint8_t(get(1));
+                int nShots = int(get(1));
+                if (nFileVersion >= 4 && nShots > s.rules.nBulletsPerTank)
+                    return false;
+                for (int n = 0; n < (nFileVersion >= 4 ? nShots : s.rules.nBulletsPerTank); n++) {
+                    olc::vf2d vBulletPos, vBulletVel;
+                    getv(vBulletPos); getv(vBulletVel);
+                    if (vBulletVel.x != 0 || vBulletVel.y != 0)
+                        s.bullets.Spawn(i, vBulletPos, vBulletVel);
+                }
+            }
+        }
+        if (!bOk || nPos != v.size())
+            return false;
+        for (int i = 0; i < s.tanks.nCount; i++)
+            if (s.tanks.aHeading[i] < 0 || s.tanks.aHeading[i] > 15)
+                return false;
+        *this = s;
+        return true;
+    }
+};
+static_assert(std::is_trivially_copyable<CombatState>::value, "CombatState must stay memcpy-able");
+
+
+class CombatSim : public CombatState
+{
+public:
+    // Fixed simulation step, in seconds
+    static constexpr float fTickTime = 1.0f / 60.0f;
+    // The step in deterministic mode, 1/60s rounded to Q16.16
+    static constexpr int32_t nTickTimeFx = 1092;
+    static constexpr double fTurnPerTickFx = 0.125 * PI * 6 * nTickTimeFx / fx::ONE;
+    // An Atari Combat round lasts 2 minutes 16 seconds
+    static constexpr int nMatchTicks = 136 * 60;
+
+
+    // Streamed boards keep walls resident this far around every tank and
+    // bullet, further than anything moves in a tick
+    static constexpr float fStreamMargin = 32;
+
+    std::shared_ptr<const CombatBoard> board;   // Static collision layer
+    WallStream stream;                          // Its resident chunks, if it's streamed
+    std::array<FlowField, 2> flow;              // With rules.bFlowAI, per team, to the other team's tanks
+    PathService paths;                          // With rules.bPathAI; kept from match to match on the same board
+    std::array<PathService::Query, nMaxTanks> aPathQueries;    // This tick's, one per AI tank
+    std::array<int8_t, nMaxTanks> aPathQuery;   // Per tank, its aPathQueries index or -1
+    SightGrid sight;                            // With rules.bSightAI
+
+    // {entity handle, contact time} pairs from one sweep. Sized in Create() for
+    // every wall plus every tank, so sweeps never allocate.
+    struct ContactBuffer
+    {
+        std::vector<std::pair<int, float>> vStore;
+        int nCount = 0;
+
+        void Reset(size_t nCapacity) { vStore.assign(nCapacity, { 0, 0.0f }); nCount = 0; }
+        void push_back(const std::pair<int, float>& c) { assert(nCount < int(vStore.size())); vStore[nCount++] = c; }
+        std::pair<int, float>* begin() { return vStore.data(); }
+        std::pair<int, float>* end() { return vStore.data() + nCount; }
+    };
+    ContactBuffer contacts;
+    std::vector<int> vCandidates;            // Reserved for every wall (or a chunk's worth) in Create()
+    olc::vf2d muzzle_pos[16] = { {7,3} ,{ 7,5 }, { 7,7 }, { 5,7 },{ 3,7 }, {2,7} ,{ 0,7 }, { 0,5 }, { 0,3 }, { 0,2 }, { 0,0 }, { 2,0 }, { 3,0 }, { 5,0 }, { 7,0 }, { 7,2 }, };
+
+public:
+    // Sets up a new match on the given board, with every tank at its starting position
+    void Create(std::shared_ptr<const CombatBoard> pBoard = CombatBoard::Default(), const CombatRules& matchRules = {})
+    {
+        assert(matchRules.nTanks >= 2 && matchRules.nTanks <= nMaxTanks && "Unsupported tank count");
+        assert(matchRules.nBulletsPerTank >= 1 && matchRules.nBulletsPerTank <= nMaxBulletsPerTank && "Unsupported bullet cap");
+        board = std::move(pBoard);
+        static_cast<CombatState&>(*this) = CombatState();
+        bullets.Reset();
+        rules = matchRules;
+        nBoardHash = board->nHash;
+
+        //Initial positiions: red on the left facing right, blue on the right facing left
+        tanks.nCount = rules.nTanks;
+        for (int i = 0; i < tanks.nCount; i++) {
+            tanks.aPos[i] = SpawnPoint(i);
+            tanks.aAng[i] = Team(i) ? float(PI) : 0.0f;
+            tanks.aHeading[i] = Team(i) ? 8 : 0;
+            tanks.aFlags[i] = TANK_ARMED;
+        }
+
+        stream.Reset(board->bStreamed ? board.get() : nullptr);
+        contacts.Reset(board->vRects.size() + nMaxTanks);
+        vCandidates.clear();
+        vCandidates.reserve(board->bStreamed ? size_t(CombatBoard::nChunkTiles * CombatBoard::nChunkTiles) : board->vRects.size());
+        if (board->bStreamed)
+            StreamWalls();
+        if (rules.bFlowAI)
+            for (FlowField& f : flow)
+                f.Build(board->sBoard, board->nBoardWidth, board->nBoardHeight, FlowTiles(), nMaxTanks);
+        if (rules.bPathAI)
+            paths.Build(board->sBoard, board->nBoardWidth, board->nBoardHeight, FlowTiles(), nMaxTanks, board->nHash);
+        if (rules.bSightAI)
+            sight.Build(board->sBoard, board->nBoardWidth, board->nBoardHeight, board->nSquareSize);
+    }
+
+    // The whole mutable state, for snapshots
+    const CombatState& State() const { return *this; }
+
+    // Rewinds or fast-forwards to a snapshot taken on the same board
+    void Restore(const CombatState& state)
+    {
+        assert(state.nBoardHash == board->nHash && "Snapshot is from a different board");
+        static_cast<CombatState&>(*this) = state;
+        if (rules.bFlowAI && flow[0].vOpen.empty())
+            for (FlowField& f : flow)
+                f.Build(board->sBoard, board->nBoardWidth, board->nBoardHeight, FlowTiles(), nMaxTanks);
+        if (rules.bPathAI)
+            paths.Build(board->sBoard, board->nBoardWidth, board->nBoardHeight, FlowTiles(), nMaxTanks, board->nHash);
+        if (rules.bSightAI && sight.vWall.empty())
+            sight.Build(board->sBoard, board->nBoardWidth, board->nBoardHeight, board->nSquareSize);
+    }
+
+    bool MatchOver() const
+    {
+        if (rules.nScoreLimit > 0 && *std::max_element(tanks.aHits.begin(), tanks.aHits.begin() + tanks.nCount) >= rules.nScoreLimit)
+            return true;
+        return nTick >= nMatchTicks;
+    }
+
+    // Advances the world by exactly fTickTime (fx::ToFloat(nTickTimeFx) in deterministic
+    // mode). input2 drives tank 1 in two-player matches and is ignored otherwise.
+    // A tick only touches CombatState and scratch buffers, so rollback can rerun it freely.
+    void Tick(const CombatInput& input, const CombatInput& input2 = {})
+    {
+        Update(input, input2, rules.bDeterministic ? fx::ToFloat(nTickTimeFx) : fTickTime);
+        nTick++;
+    }
+
+    // FNV-1a over everything that evolves during a match; equal hashes after
+    // equal inputs mean two runs stayed in lockstep
+    uint64_t StateHash() const
+    {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&](const void* p, size_t n) {
+            for (size_t i = 0; i < n; i++) { h ^= static_cast<const uint8_t*>(p)[i]; h *= 1099511628211ull; }
+        };
+        auto mixv = [&](const olc::vf2d& v) { mix(&v.x, sizeof(float)); mix(&v.y, sizeof(float)); };
+        for (int i = 0; i < tanks.nCount; i++) {
+            mixv(tanks.aPos[i]); mixv(tanks.aVel[i]);
+            uint8_t nShots = bullets.aCount[i];
+            mix(&nShots, 1);
+            for (int n = 0; n < nShots; n++) {
+                mixv(bullets.aPos[bullets.Slot(i, n)]); mixv(bullets.aVel[bullets.Slot(i, n)]);
+            }
+            mix(&tanks.aAng[i], sizeof(float)); mix(&tanks.aScore[i], sizeof(int));
+            uint8_t flags = uint8_t(tanks.aFlags[i] & (TANK_ARMED | TANK_SPINNING));
+            mix(&flags, 1);
+        }
+        mix(&fAccumTime, sizeof(fAccumTime));
+        for (int i = 0; i < tanks.nCount; i++)
+            mix(&tanks.aHeading[i], sizeof(int));
+        mix(&nTick, sizeof(nTick));
+        return h;
+    }
+
+    // Where tank i starts: the board's spawn for it if it has one (the
+    // original spots for the first two on boards without any), and for the
+    // rest the free spot nearest their team's first, on a 12 pixel lattice
+    // over the team's half of the board
+    olc::vf2d SpawnPoint(int nTank) const
+    {
+        int nTeam = Team(nTank);
+        const std::vector<olc::vf2d>& vTeamSpawns = board->vSpawns[nTeam];
+        if (size_t(nTank / 2) < vTeamSpawns.size())
+            return vTeamSpawns[nTank / 2];
+        const olc::vf2d aOriginal[2] = { { 70, 68 }, { 168, 68 } };
+        olc::vf2d vHome = vTeamSpawns.empty() ? aOriginal[nTeam] : vTeamSpawns[0];
+        if (nTank < 2)
+            return vHome;
+
+        float fHalf = float(board->nBoardWidth * board->nSquareSize) / 2;
+        float fHeight = float(board->nBoardHeight * board->nSquareSize);
+        olc::vf2d vBest;
+        float fBest = -1;
+        for (float y = vHome.y - 12 * std::floor(vHome.y / 12); y + vTankSize.y <= fHeight; y += 12)
+            for (float x = vHome.x - 12 * std::floor(vHome.x / 12); x + vTankSize.x <= 2 * fHalf; x += 12) {
+                if ((x + vTankSize.x / 2 < fHalf) != (nTeam == 0))
+                    continue;
+                olc::aabb::rect spot = { { x - 2, y - 2 }, vTankSize + olc::vf2d{ 4, 4 } };
+                bool bFree = spot.pos.x >= 0 && spot.pos.y >= 0 && !board->AnyWall(spot);
+                for (int i = 0; i < nTank && bFree; i++) {
+                    olc::aabb::rect other = { tanks.aPos[i], vTankSize };
+                    bFree = !olc::aabb::RectVsRect(&spot, &other);
+                }
+                float fDist = (olc::vf2d{ x, y } - vHome).mag2();
+                if (bFree && (fBest < 0 || fDist < fBest)) {
+                    vBest = { x, y };
+                    fBest = fDist;
+                }
+            }
+        assert(fBest >= 0 && "No room left to spawn a tank");
+        return vBest;
+    }
+
+private:
+    olc::aabb::rect TankRect(int i) const { return { tanks.aPos[i], vTankSize, tanks.aVel[i] }; }
+    olc::aabb::rect BulletRect(int s) const { return { bullets.aPos[s], vBulletSize, bullets.aVel[s] }; }
+
+    // Velocity fSpeed along heading i (0-15)
+    olc::vf2d Heading(int i, float fSpeed) const
+    {
+        if (rules.bDeterministic)
+            return fx::ToFloat(olc::vi2d{ fx::aHeading[i][0] * int32_t(fSpeed), fx::aHeading[i][1] * int32_t(fSpeed) });
+        return { float(fSpeed * cosf(i * 0.125 * PI)), float(fSpeed * sinf(i * 0.125 * PI)) };
+    }
+
+    void Advance(olc::vf2d& pos, const olc::vf2d& vel, float fElapsedTime) const
+    {
+        if (rules.bDeterministic)
+            pos = fx::ToFloat(fx::FromFloat(pos) + olc::vi2d{ fx::Mul(fx::FromFloat(vel.x), nTickTimeFx), fx::Mul(fx::FromFloat(vel.y), nTickTimeFx) });
+        else
+            pos += vel * fElapsedTime;
+    }
+
+    // Resolves mover against one contact from SweepMover; tanks are moving targets
+    bool ResolveContact(olc::aabb::rect* mover, float fElapsedTime, int handle)
+    {
+        olc::aabb::rect tank;
+        const olc::aabb::rect* target = &tank;
+        if (HandleKind(handle) == ENTITY_WALL)
+            target = &(board->bStreamed ? stream.vRects : board->vRects)[HandleIndex(handle)];
+        else
+            tank = TankRect(HandleIndex(handle));
+        if (!rules.bDeterministic) {
+            if (HandleKind(handle) == ENTITY_WALL)
+                return olc::aabb::ResolveDynamicRectVsRect(mover, fElapsedTime, target);
+            return olc::aabb::ResolveDynamicRectVsDynamicRect(mover, fElapsedTime, target);
+        }
+
+        // Same responses as the olc::aabb resolvers, with the products taken in fixed point
+        bool bWall = HandleKind(handle) == ENTITY_WALL;
+        olc::vf2d cp, cn;
+        float t = 0;
+        if (bWall ? !olc::aabb::DynamicRectVsRect(mover, fElapsedTime, *target, cp, cn, t)
+                  : !olc::aabb::DynamicRectVsDynamicRect(mover, fElapsedTime, *target, cp, cn, t))
+            return false;
+        olc::vi2d vel = fx::FromFloat(mover->vel), rel = bWall ? vel : vel - fx::FromFloat(target->vel);
+        int32_t nRemain = fx::ONE - int32_t(t * fx::ONE);
+        vel.x += int32_t(cn.x) * fx::Mul(std::abs(rel.x), nRemain);
+        vel.y += int32_t(cn.y) * fx::Mul(std::abs(rel.y), nRemain);
+        if (bWall) {
+            // Rounding mustn't leave the mover moving through the wall's face:
+            // once a step inside, no sweep would find that wall again. A
+            // corner met dead on has no normal, so both faces by it count.
+            olc::vi2d pos = fx::FromFloat(mover->pos), size = fx::FromFloat(mover->size);
+            olc::vi2d lo = fx::FromFloat(target->pos), hi = lo + fx::FromFloat(target->size);
+            olc::vi2d n = { int32_t(cn.x), int32_t(cn.y) };
+            if (n.x == 0 && n.y == 0)
+                n = { vel.x < 0 ? 1 : vel.x > 0 ? -1 : 0, vel.y < 0 ? 1 : vel.y > 0 ? -1 : 0 };
+            if (n.x != 0)
+                vel.x = ClampToFace(vel.x, n.x > 0 ? pos.x - hi.x : lo.x - (pos.x + size.x), n.x);
+            if (n.y != 0)
+                vel.y = ClampToFace(vel.y, n.y > 0 ? pos.y - hi.y : lo.y - (pos.y + size.y), n.y);
+        }
+        mover->vel = fx::ToFloat(vel);
+        return true;
+    }
+
+    // The fastest nVel against a face nGap away, on the nNormal side of it,
+    // whose step in Advance stops at the face
+    static int32_t ClampToFace(int32_t nVel, int32_t nGap, int nNormal)
+    {
+        int32_t nToward = nNormal > 0 ? -nVel : nVel;
+        int32_t nMax = int32_t((int64_t(std::max(nGap, 0)) << 16) / nTickTimeFx);
+        return nToward <= nMax ? nVel : (nNormal > 0 ? -nMax : nMax);
+    }
+
+    // Fills contacts with every {entity handle, contact time} the mover would
+    // hit this step, sorted by time: the walls near its swept box from the
+    // static layer, then every tank but nIgnore and those on team nIgnoreTeam
+    // (-1 for none), swept against their own motion. Bullets are never hit by
+    // anything.
+    void SweepMover(const olc::aabb::rect& mover, float fElapsedTime, int nIgnore, int nIgnoreTeam = -1)
+    {
+        SweepWalls(mover, fElapsedTime);
+        olc::vf2d cp, cn;
+        float t = 0;
+        for (int i = 0; i < tanks.nCount; i++) {
+            if (i == nIgnore || Team(i) == nIgnoreTeam)
+                continue;
+            if (olc::aabb::DynamicRectVsDynamicRect(&mover, fElapsedTime, TankRect(i), cp, cn, t))
+                contacts.push_back({ EntityHandle(ENTITY_TANK, i), t });
+        }
+        SortContacts();
+    }
+
+    // Fills contacts with the walls the mover would hit this step, unsorted
+    void SweepWalls(const olc::aabb::rect& mover, float fElapsedTime)
+    {
+        olc::vf2d vEnd = mover.pos + mover.vel * fElapsedTime;
+        olc::vf2d tl = mover.pos.min(vEnd), br = (mover.pos + mover.size).max(vEnd + mover.size);
+        if (board->bStreamed) {
+            // Chunk by chunk, with each chunk's hits renumbered into stream.vRects
+            contacts.nCount = 0;
+            stream.Query(tl, br, [&](const WallStream::Chunk& c) {
+                vCandidates.clear();
+                c.wallGrid.Query(tl, br, [&](int i) { vCandidates.push_back(i); });
+                std::pair<int, float>* pHits = contacts.begin() + contacts.nCount;
+                int nHits = olc::aabb::SweepRects(&mover, fElapsedTime, c.wallSoA, vCandidates.data(), int(vCandidates.size()), pHits);
+                for (int i = 0; i < nHits; i++)
+                    pHits[i].first += c.nFirst;
+                contacts.nCount += nHits;
+            });
+        }
+        else {
+            vCandidates.clear();
+            board->wallGrid.Query(tl, br, [&](int i) { vCandidates.push_back(i); });
+            contacts.nCount = olc::aabb::SweepRects(&mover, fElapsedTime, board->wallSoA, vCandidates.data(), int(vCandidates.size()), contacts.begin());
+        }
+    }
+
+    void SortContacts()
+    {
+        std::sort(contacts.begin(), contacts.end(), [](const std::pair<int, float>& a, const std::pair<int, float>& b)
+            {
+                return a.second < b.second;
+            });
+    }
+
+    // Makes the chunks around every tank and live bullet resident. Only
+    // allocates on the ticks where that set changes.
+    void StreamWalls()
+    {
+        olc::vf2d vMargin = { fStreamMargin, fStreamMargin };
+        for (int i = 0; i < tanks.nCount; i++) {
+            stream.Want(tanks.aPos[i] - vMargin, tanks.aPos[i] + vTankSize + vMargin);
+            for (int n = 0; n < bullets.Count(i); n++)
+                stream.Want(bullets.aPos[bullets.Slot(i, n)] - vMargin, bullets.aPos[bullets.Slot(i, n)] + vBulletSize + vMargin);
+        }
+        if (stream.Commit() && size_t(contacts.vStore.size()) < stream.vRects.size() + nMaxTanks)
+            contacts.Reset(stream.vRects.size() + nMaxTanks);
+    }
+
+    // Drives a player's tank from its keys
+    void DriveTank(int i, const CombatInput& input, float fElapsedTime)
+    {
+        if (input.bUp || input.bDown) {
+            tanks.aVel[i] = Heading(tanks.aHeading[i], 6);
+        }
+        else {
+            tanks.aVel[i] = { 0,0 };
+        }
+
+        if (input.bDown) {
+            tanks.aVel[i] = { -tanks.aVel[i].x, -tanks.aVel[i].y };
+        }
+
+        if (input.bLeft) {
+            tanks.aAng[i] += rules.bDeterministic ? fTurnPerTickFx : 0.125 * PI * fElapsedTime * 6;
+        }
+        if (input.bRight) {
+            tanks.aAng[i] -= rules.bDeterministic ? fTurnPerTickFx : 0.125 * PI * fElapsedTime * 6;
+        }
+        if (std::abs(tanks.aAng[i]) >= 2 * PI)
+            tanks.aAng[i] = 0;
+    }
+
+    int FlowTiles() const { return CombatBoard::FlowTiles(board->nSquareSize); }
+
+    // The flow field cell tank i's corner is in
+    int FlowCell(int i) const
+    {
+        int x = std::max(0, std::min(int(std::floor(tanks.aPos[i].x / board->nSquareSize)), board->nBoardWidth - 1));
+        int y = std::max(0, std::min(int(std::floor(tanks.aPos[i].y / board->nSquareSize)), board->nBoardHeight - 1));
+        return y * board->nBoardWidth + x;
+    }
+
+    // Points each team's field at the other team's tanks, for teams with an AI tank
+    void UpdateFlow()
+    {
+        std::array<int, nMaxTanks> aGoals;
+        for (int t = 0; t < 2; t++) {
+            bool bAI = false;
+            for (int i = t; i < tanks.nCount && !bAI; i += 2)
+                bAI = Player(i) < 0;
+            if (!bAI)
+                continue;
+            int nGoals = 0;
+            for (int i = 1 - t; i < tanks.nCount; i += 2)
+                aGoals[nGoals++] = FlowCell(i);
+            flow[t].Update(aGoals.data(), nGoals);
+        }
+    }
+
+    // Asks for a path from every AI tank to the nearest enemy, by cells
+    // across and down, in one batch
+    void UpdatePaths()
+    {
+        int nQueries = 0;
+        for (int i = 0; i < tanks.nCount; i++) {
+            aPathQuery[i] = -1;
+            if (Player(i) >= 0)
+                continue;
+            int nStart = FlowCell(i), nGoal = -1, nBest = 0, w = board->nBoardWidth;
+            for (int j = 1 - Team(i); j < tanks.nCount; j += 2) {
+                int c = FlowCell(j), n = std::abs(c % w - nStart % w) + std::abs(c / w - nStart / w);
+                if (nGoal < 0 || n < nBest) {
+                    nBest = n;
+                    nGoal = c;
+                }
+            }
+            aPathQuery[i] = int8_t(nQueries);
+            aPathQueries[nQueries++] = { nStart, nGoal };
+        }
+        paths.Solve(aPathQueries.data(), nQueries);
+    }
+
+    // Steers for the next cell on tank i's path. False on the goal or with no path.
+    bool DrivePath(int i)
+    {
+        if (aPathQuery[i] < 0 || aPathQueries[aPathQuery[i]].nNext < 0)
+            return false;
+        DriveToward(i, aPathQueries[aPathQuery[i]].nNext);
+        return true;
+    }
+
+    // Steers for the next cell down the field. False on a goal or cut off from every one.
+    bool DriveFlow(int i)
+    {
+        const FlowField& f = flow[Team(i)];
+        int nCell = FlowCell(i), nStep = f.Step(nCell);
+        if (nStep < 0)
+            return false;
+        DriveToward(i, f.Next(nCell, nStep));
+        return true;
+    }
+
+    // Turns a heading at a time towards the middle of cell nCell, and drives
+    // once facing within a heading of it
+    void DriveToward(int i, int nCell)
+    {
+        int w = board->nBoardWidth;
+        olc::vi2d d = fx::FromFloat((olc::vf2d{ float(nCell % w), float(nCell / w) } + olc::vf2d{ 0.5f, 0.5f }) * float(board->nSquareSize) - tanks.aPos[i]);
+        int nWant = 0;
+        int64_t nBest = INT64_MIN;
+        for (int h = 0; h < 16; h++) {
+            int64_t nDot = int64_t(fx::aHeading[h][0]) * d.x + int64_t(fx::aHeading[h][1]) * d.y;
+            if (nDot > nBest) {
+                nBest = nDot;
+                nWant = h;
+            }
+        }
+        int nTurn = (nWant - tanks.aHeading[i] + 16) % 16, h = tanks.aHeading[i];
+        if (nTurn != 0)
+            h = (h + (nTurn < 8 ? 1 : 15)) % 16;
+        tanks.aAng[i] = float(-(h + 0.5) * 0.125 * PI);    // Mid-sector, so UpdateHeading() gives back h
+        SetFlag(i, TANK_BLOCKED, false);
+        UpdateHeading(i);
+        tanks.aVel[i] = (nTurn <= 1 || nTurn >= 15) ? Heading(tanks.aHeading[i], rules.fAISpeed) : olc::vf2d{ 0, 0 };
+    }
+
+    // Whether a shot from tank i along its heading would reach an enemy tank
+    // before a wall. Shots pass through their own side, so only enemies count.
+    bool ClearShot(int i) const
+    {
+        int h = tanks.aHeading[i];
+        int32_t dx = fx::aHeading[h][0], dy = fx::aHeading[h][1];
+        olc::vi2d p = fx::FromFloat(tanks.aPos[i] + muzzle_pos[h] + vBulletSize / 2);
+        olc::vi2d vBox = fx::FromFloat(vTankSize + vBulletSize);
+        int32_t nNearest = -1;
+        for (int j = 1 - Team(i); j < tanks.nCount; j += 2) {
+            olc::vi2d b = fx::FromFloat(tanks.aPos[j] - vBulletSize / 2);
+            int32_t t = SightGrid::RayVsBox(p.x, p.y, dx, dy, b.x, b.y, vBox.x, vBox.y);
+            if (t >= 0 && (nNearest < 0 || t < nNearest))
+                nNearest = t;
+        }
+        return nNearest >= 0 && sight.Cast(p.x, p.y, dx, dy, nNearest).nAxis < 0;
+    }
+
+    // Drives forward and turns away from whatever it last ran into
+    void DriveAI(int i)
+    {
+        if (rules.bPathAI ? DrivePath(i) : rules.bFlowAI && DriveFlow(i))
+            return;
+        if (HasFlag(i, TANK_BLOCKED)) {
+            tanks.aAng[i] -= (0.125 * PI);
+            SetFlag(i, TANK_BLOCKED, false);
+        }
+        if (std::abs(tanks.aAng[i]) >= 2 * PI)
+            tanks.aAng[i] = 0;
+        UpdateHeading(i);
+        tanks.aVel[i] = Heading(tanks.aHeading[i], rules.fAISpeed);
+    }
+
+    //Set rotation to one of 16 positions
+    void UpdateHeading(int i)
+    {
+        int h = (int((tanks.aAng[i] / PI) * 8)); h = (h < 0) ? std::abs(h) : 16 - h; if (h == 16) h = 0;
+        tanks.aHeading[i] = h;
+    }
+
+    // Spawns a shot from the pool; a tank at its cap, or finding the pool
+    // empty, recycles its oldest shot instead. With nothing to recycle either,
+    // the shot is lost.
+    void FireBullet(int i)
+    {
+        if (bullets.Count(i) > 0 && (bullets.Count(i) >= rules.nBulletsPerTank || bullets.nFree == 0))
+            bullets.Despawn(i, 0);
+        if (bullets.Spawn(i, muzzle_pos[tanks.aHeading[i]] + tanks.aPos[i], Heading(tanks.aHeading[i], 100)) < 0)
+            return;
+        SetFlag(i, TANK_ARMED, true);
+        tanks.aShots[i]++;
+    }
+
+    bool AnySpinning() const
+    {
+        for (int i = 0; i < tanks.nCount; i++)
+            if (HasFlag(i, TANK_SPINNING))
+                return true;
+        return false;
+    }
+
+    void Update(const CombatInput& input, const CombatInput& input2, float fElapsedTime)
+    {
+        // Steer: spin out if hit, else follow the keys or the AI. Red tanks spin
+        // one way and blue the other, as on the Atari.
+        {
+            FrameProfiler::Scope scope(FrameProfiler::STAGE_AI);
+            if (rules.bPathAI)
+                UpdatePaths();
+            else if (rules.bFlowAI)
+                UpdateFlow();
+            for (int i = 0; i < tanks.nCount; i++) {
+                int nPlayer = Player(i);
+                if (HasFlag(i, TANK_SPINNING)) {
+                    if (Team(i) == 0)
+                        tanks.aAng[i] -= 0.125 * PI;
+                    else
+                        tanks.aAng[i] += 0.125 * PI;
+                    if (std::abs(tanks.aAng[i]) >= 2 * PI)
+                        tanks.aAng[i] = 0;
+                }
+                else if (nPlayer >= 0)
+                    DriveTank(i, nPlayer == 0 ? input : input2, fElapsedTime);
+                else
+                    DriveAI(i);
+                UpdateHeading(i);
+            }
+        }
+
+        //Fire bullet
+        if (!AnySpinning()) {
+            if (input.bFire)
+                FireBullet(0);
+            if (rules.bTwoPlayer && input2.bFire)
+                FireBullet(1);
+        }
+
+        fAccumTime += fElapsedTime;
+        if (fAccumTime > 1) {
+            if (AnySpinning()) {   //Resume after spin
+                for (int i = 0; i < tanks.nCount; i++) {
+                    SetFlag(i, TANK_ARMED, true);
+                    SetFlag(i, TANK_SPINNING, false);
+                }
+            }
+        }
+
+        {
+            FrameProfiler::Scope scope(FrameProfiler::STAGE_AI);
+            if (fAccumTime > rules.fAIFireDelay) {
+                bool bFired = false;
+                for (int i = 0; i < tanks.nCount; i++)  //Fire bullet every few seconds
+                    if (Player(i) < 0 && HasFlag(i, TANK_ARMED) && (!rules.bSightAI || ClearShot(i))) {
+                        FireBullet(i);
+                        bFired = true;
+                    }
+                if (bFired || !rules.bSightAI)  // With sight, the first to get a shot ends the wait
+                    fAccumTime = 0;
+            }
+        }
+
+        //Precess motion for tanks and bullets. Every sweep sees all bodies where
+        //they stand at the start of the tick; positions only advance at the end.
+        if (board->bStreamed)
+            StreamWalls();
+
+        //Bullets first, so a hit's knockback is resolved against walls below.
+        //They pass through their own team, and go back to the pool once they
+        //hit anything.
+        for (int k = 0; k < tanks.nCount; k++) {
+            FrameProfiler::Scope scope(FrameProfiler::STAGE_BULLETS);
+            for (int n = 0; n < bullets.Count(k) && HasFlag(k, TANK_ARMED); ) {
+                int s = bullets.Slot(k, n);
+
+                // Work out collision point, add it to contacts along with rect ID
+                olc::aabb::rect bullet = BulletRect(s);
+                SweepMover(bullet, fElapsedTime, k, Team(k));
+
+                // Now resolve the collision in correct order
+                for (auto j : contacts) {
+                    if (ResolveContact(&bullet, fElapsedTime, j.first)) {
+                        // Collided with object is an enemy tank
+                        if (HandleKind(j.first) == ENTITY_TANK) {
+                            int nHit = HandleIndex(j.first);
+                            SetFlag(nHit, TANK_SPINNING, true); tanks.aScore[k] += 1; tanks.aHits[k]++;
+                            if (tanks.aScore[k] > 99)
+                                tanks.aScore[k] = 0;
+                            tanks.aVel[nHit] += (2 * bullet.vel); //Blown back
+                            for (int i = 0; i < tanks.nCount; i++)  //Pause fighting; players' shots stay live
+                                if (Player(i) < 0)
+                                    SetFlag(i, TANK_ARMED, false);
+                            fAccumTime = 0;
+                        }
+                        bullet.vel = { 0,0 };
+                    }
+                }
+                if (bullet.vel.x == 0 && bullet.vel.y == 0) {
+                    bullets.Despawn(k, n);      // Its successor moves up to n
+                    continue;
+                }
+                bullets.aVel[s] = bullet.vel;
+                n++;
+            }
+        }
+
+        for (int k = 0; k < tanks.nCount; k++) {
+            FrameProfiler::Scope scope(FrameProfiler::STAGE_TANKS);
+
+            // Work out collision point, add it to contacts along with rect ID
+            olc::aabb::rect tank = TankRect(k);
+            SweepMover(tank, fElapsedTime, k);
+
+            // Now resolve the collision in correct order
+            bool collision = false, pushed = false;
+            for (auto j : contacts) {
+                if (ResolveContact(&tank, fElapsedTime, j.first)) {
+                    collision = true;
+                    pushed = pushed || HandleKind(j.first) == ENTITY_TANK;
+                }
+            }
+
+            // Another tank can leave this one moving where its sweep never
+            // looked, as when a parked tank is shoved, so walls get the last
+            // word along the velocity it ends up with
+            if (pushed) {
+                SweepWalls(tank, fElapsedTime);
+                SortContacts();
+                for (auto j : contacts)
+                    ResolveContact(&tank, fElapsedTime, j.first);
+            }
+            tanks.aVel[k] = tank.vel;
+
+            if (collision && Player(k) < 0)     //AI tank turns away from whatever it ran into
+                SetFlag(k, TANK_BLOCKED, true);
+        }
+
+        // UPdate the bullet and tank rectangles positions, with their modified velocities
+        for (int k = 0; k < tanks.nCount; k++) {
+            if (HasFlag(k, TANK_ARMED))
+                for (int n = 0; n < bullets.Count(k); n++)
+                    Advance(bullets.aPos[bullets.Slot(k, n)], bullets.aVel[bullets.Slot(k, n)], fElapsedTime);
+            Advance(tanks.aPos[k], tanks.aVel[k], fElapsedTime); //Upade position of tank
+        }
+    }
+};
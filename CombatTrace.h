@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records begin/end/instant events from any thread and writes them as Chrome
+// trace-event JSON (chrome://tracing, ui.perfetto.dev). Each thread gets its
+// own ring the first time it records, and from then on it's the only writer,
+// so recording is a clock read and a few plain stores. When a ring wraps, the
+// oldest events are overwritten. Flush can run on any thread while the
+// others keep recording; like a seqlock, it drops any slot the owner started
+// rewriting while it was being read.
+class TraceRecorder
+{
+public:
+    static constexpr int nRingSize = 1 << 16;   // Events per thread, 1MB
+
+    static void Begin(const char* sName) { Record(sName, 'B'); }
+    static void End(const char* sName) { Record(sName, 'E'); }
+    static void Instant(const char* sName) { Record(sName, 'i'); }
+
+    // Recording is off until Enable(true); names must be string literals or
+    // otherwise outlive the last Flush
+    static void Enable(bool bOn) { Instance().bEnabled.store(bOn, std::memory_order_relaxed); }
+    static bool Enabled() { return Instance().bEnabled.load(std::memory_order_relaxed); }
+
+    // Labels the calling thread's track in the trace
+    static void NameThread(const char* sName)
+    {
+        if (!Enabled())
+            return;
+        ThreadRing().sThreadName.store(sName, std::memory_order_relaxed);
+    }
+
+    struct Scope
+    {
+        const char* sName;
+        explicit Scope(const char* s) : sName(s) { Begin(sName); }
+        ~Scope() { End(sName); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // Writes every thread's events to sFile as {"traceEvents":[...]}
+    static bool Flush(const std::string& sFile)
+    {
+        TraceRecorder& tr = Instance();
+        std::vector<Ring*> vRings;
+        {
+            std::lock_guard<std::mutex> lock(tr.muxRings);
+            for (auto& r : tr.vRings)
+                vRings.push_back(r.get());
+        }
+
+        std::ofstream f(sFile);
+        if (!f)
+            return false;
+        f << "{\"traceEvents\":[\n";
+        bool bFirst = true;
+        auto sep = [&]() { f << (bFirst ? "" : ",\n"); bFirst = false; };
+        std::vector<Event> vEvents;
+        for (Ring* r : vRings) {
+            const char* sThread = r->sThreadName.load(std::memory_order_relaxed);
+            sep();
+            f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << r->nThreadId << ",\"args\":{\"name\":\"";
+            if (sThread) f << sThread; else f << "thread " << r->nThreadId;
+            f << "\"}}";
+
+            // Copy out what the ring holds, then drop anything the owner
+            // may have overwritten while we copied
+            uint64_t nHead = r->nHead.load(std::memory_order_acquire);
+            uint64_t nFirst = nHead > uint64_t(nRingSize) ? nHead - nRingSize : 0;
+            vEvents.clear();
+            for (uint64_t i = nFirst; i < nHead; i++) {
+                const Slot& s = r->aSlots[i % nRingSize];
+                vEvents.push_back({ s.nTimeAndPhase.load(std::memory_order_relaxed), s.pName.load(std::memory_order_relaxed) });
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t nWriting = r->nWriting.load(std::memory_order_relaxed);
+            size_t nSkip = 0;
+            if (nWriting > uint64_t(nRingSize) && nWriting - nRingSize > nFirst)
+                nSkip = size_t(std::min<uint64_t>(vEvents.size(), nWriting - nRingSize - nFirst));
+
+            // An end whose begin was lost to wrapping would close the wrong slice
+            int nDepth = 0;
+            for (size_t i = nSkip; i < vEvents.size(); i++) {
+                char cPhase = char(vEvents[i].nTimeAndPhase & 0xFF);
+                if (cPhase == 'B') nDepth++;
+                else if (cPhase == 'E' && nDepth-- == 0) { nDepth = 0; continue; }
+                sep();
+                double fMicros = double(vEvents[i].nTimeAndPhase >> 8) / 1000.0;
+                f << "{\"name\":\"" << vEvents[i].sName << "\",\"ph\":\"" << cPhase << "\",\"ts\":" << std::fixed << fMicros << std::defaultfloat
+                    << ",\"pid\":1,\"tid\":" << r->nThreadId << (cPhase == 'i' ? ",\"s\":\"t\"}" : "}");
+            }
+        }
+        f << "\n]}\n";
+        return bool(f);
+    }
+
+private:
+    // Time since the recorder started, in ns, above the phase character
+    struct Slot
+    {
+        std::atomic<uint64_t> nTimeAndPhase{ 0 };
+        std::atomic<const char*> pName{ nullptr };
+    };
+    struct Event
+    {
+        uint64_t nTimeAndPhase;
+        const char* sName;
+    };
+    struct alignas(64) Ring
+    {
+        std::atomic<uint64_t> nHead{ 0 };       // Events fully written
+        std::atomic<uint64_t> nWriting{ 0 };    // Events started; a slot is rewritten only after this passes it
+        std::atomic<const char*> sThreadName{ nullptr };
+        int nThreadId = 0;
+        std::array<Slot, nRingSize> aSlots;
+    };
+
+    using clock = std::chrono::steady_clock;
+    const clock::time_point tpStart = clock::now();
+    std::atomic<bool> bEnabled{ false };
+    std::mutex muxRings;
+    std::vector<std::unique_ptr<Ring>> vRings;   // Never freed, so a ring outlives its thread
+
+    static TraceRecorder& Instance()
+    {
+        static TraceRecorder tr;
+        return tr;
+    }
+
+    // Registers a ring for this thread on first use; the only lock taken
+    static Ring& ThreadRing()
+    {
+        static thread_local Ring* pRing = nullptr;
+        if (!pRing) {
+            TraceRecorder& tr = Instance();
+            std::lock_guard<std::mutex> lock(tr.muxRings);
+            tr.vRings.push_back(std::make_unique<Ring>());
+            pRing = tr.vRings.back().get();
+            pRing->nThreadId = int(tr.vRings.size());
+        }
+        return *pRing;
+    }
+
+    static void Record(const char* sName, char cPhase)
+    {
+        TraceRecorder& tr = Instance();
+        if (!tr.bEnabled.load(std::memory_order_relaxed))
+            return;
+        Ring& r = ThreadRing();
+        uint64_t nNanos = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - tr.tpStart).count());
+        uint64_t nHead = r.nHead.load(std::memory_order_relaxed);
+        r.nWriting.store(nHead + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Slot& s = r.aSlots[nHead % nRingSize];
+        s.nTimeAndPhase.store((nNanos << 8) | uint8_t(cPhase), std::memory_order_relaxed);
+        s.pName.store(sName, std::memory_order_relaxed);
+        r.nHead.store(nHead + 1, std::memory_order_release);
+    }
+};
@@ -0,0 +1,540 @@
+#pragma once
+/*
+    olcAABB.h - axis-aligned rectangle collision for Combat
+
+    The swept rect tests are javidx9's olc::aabb routines from the "Arbitrary
+    Rectangle Collision Detection & Resolution" video, plus the pieces Combat
+    needs to run them in bulk:
+
+    grid        Uniform grid broadphase over a fixed set of rects
+    rect_soa    Structure-of-arrays copy of a fixed set of rects
+    SweepRects  Sweeps one moving rect against many rects of a rect_soa at
+                once, using AVX2 or SSE2 when the CPU has them. Results are
+                bit-identical to calling DynamicRectVsRect on each rect,
+                which remains the reference implementation; the headless
+                build's --check-sweep holds every path to it.
+*/
+#include "olcPixelGameEngine.h"
+#include <cmath>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+#undef min
+#undef max
+
+namespace olc
+{
+    namespace aabb
+    {
+        struct rect
+        {
+            olc::vf2d pos;
+            olc::vf2d size;
+            olc::vf2d vel = { 0, 0 };
+
+            std::array<const olc::aabb::rect*, 4> contact = {};
+        };
+
+        inline bool PointVsRect(const olc::vf2d& p, const olc::aabb::rect* r)
+        {
+            return (p.x >= r->pos.x && p.y >= r->pos.y && p.x < r->pos.x + r->size.x && p.y < r->pos.y + r->size.y);
+        }
+
+        inline bool RectVsRect(const olc::aabb::rect* r1, const olc::aabb::rect* r2)
+        {
+            return (r1->pos.x < r2->pos.x + r2->size.x && r1->pos.x + r1->size.x > r2->pos.x && r1->pos.y < r2->pos.y + r2->size.y && r1->pos.y + r1->size.y > r2->pos.y);
+        }
+
+        inline bool RayVsRect(const olc::vf2d& ray_origin, const olc::vf2d& ray_dir, const rect* target, olc::vf2d& contact_point, olc::vf2d& contact_normal, float& t_hit_near)
+        {
+            contact_normal = { 0,0 };
+            contact_point = { 0,0 };
+
+            // Cache division
+            olc::vf2d invdir = 1.0f / ray_dir;
+
+            // Calculate intersections with rectangle bounding axes
+            olc::vf2d t_near = (target->pos - ray_origin) * invdir;
+            olc::vf2d t_far = (target->pos + target->size - ray_origin) * invdir;
+
+            if (std::isnan(t_far.y) || std::isnan(t_far.x)) return false;
+            if (std::isnan(t_near.y) || std::isnan(t_near.x)) return false;
+
+            // Sort distances
+            if (t_near.x > t_far.x) std::swap(t_near.x, t_far.x);
+            if (t_near.y > t_far.y) std::swap(t_near.y, t_far.y);
+
+            // Early rejection
+            if (t_near.x > t_far.y || t_near.y > t_far.x) return false;
+
+            // Closest 'time' will be the first contact
+            t_hit_near = std::max(t_near.x, t_near.y);
+
+            // Furthest 'time' is contact on opposite side of target
+            float t_hit_far = std::min(t_far.x, t_far.y);
+
+            // Reject if ray direction is pointing away from object
+            if (t_hit_far < 0)
+                return false;
+
+            // Contact point of collision from parametric line equation
+            contact_point = ray_origin + t_hit_near * ray_dir;
+
+            if (t_near.x > t_near.y)
+            {
+                if (invdir.x < 0)
+                    contact_normal = { 1, 0 };
+                else
+                    contact_normal = { -1, 0 };
+            }
+            else if (t_near.x < t_near.y)
+            {
+                if (invdir.y < 0)
+                    contact_normal = { 0, 1 };
+                else
+                    contact_normal = { 0, -1 };
+            }
+
+            // Note if t_near == t_far, collision is principly in a diagonal
+            // so pointless to resolve. By returning a CN={0,0} even though its
+            // considered a hit, the resolver wont change anything.
+            return true;
+        }
+
+        inline bool DynamicRectVsRect(const olc::aabb::rect* r_dynamic, const float fTimeStep, const olc::aabb::rect& r_static,
+            olc::vf2d& contact_point, olc::vf2d& contact_normal, float& contact_time)
+        {
+            // Check if dynamic rectangle is actually moving - we assume rectangles are NOT in collision to start
+            if (r_dynamic->vel.x == 0 && r_dynamic->vel.y == 0)
+                return false;
+
+            // Expand target rectangle by source dimensions
+            olc::aabb::rect expanded_target;
+            expanded_target.pos = r_static.pos - r_dynamic->size / 2;
+            expanded_target.size = r_static.size + r_dynamic->size;
+
+            if (RayVsRect(r_dynamic->pos + r_dynamic->size / 2, r_dynamic->vel * fTimeStep, &expanded_target, contact_point, contact_normal, contact_time))
+                return (contact_time >= 0.0f && contact_time < 1.0f);
+            else
+                return false;
+        }
+
+
+
+        inline bool ResolveDynamicRectVsRect(olc::aabb::rect* r_dynamic, const float fTimeStep, const olc::aabb::rect* r_static)
+        {
+            olc::vf2d contact_point, contact_normal;
+            float contact_time = 0.0f;
+            if (DynamicRectVsRect(r_dynamic, fTimeStep, *r_static, contact_point, contact_normal, contact_time))
+            {
+                if (contact_normal.y > 0) r_dynamic->contact[0] = r_static;
+                if (contact_normal.x < 0) r_dynamic->contact[1] = r_static;
+                if (contact_normal.y < 0) r_dynamic->contact[2] = r_static;
+                if (contact_normal.x > 0) r_dynamic->contact[3] = r_static;
+
+                r_dynamic->vel += contact_normal * olc::vf2d(std::abs(r_dynamic->vel.x), std::abs(r_dynamic->vel.y)) * (1 - contact_time);
+                return true;
+            }
+
+            return false;
+        }
+
+        // Both rects moving: sweep r_dynamic with its velocity relative to r_target,
+        // against r_target where it stands at the start of the step. A hit means
+        // they meet at some point during the step even if neither rect is where
+        // the other was at its start, so fast or coarse steps can't tunnel.
+        inline bool DynamicRectVsDynamicRect(const olc::aabb::rect* r_dynamic, const float fTimeStep, const olc::aabb::rect& r_target,
+            olc::vf2d& contact_point, olc::vf2d& contact_normal, float& contact_time)
+        {
+            olc::aabb::rect relative;
+            relative.pos = r_dynamic->pos;
+            relative.size = r_dynamic->size;
+            relative.vel = r_dynamic->vel - r_target.vel;
+            return DynamicRectVsRect(&relative, fTimeStep, r_target, contact_point, contact_normal, contact_time);
+        }
+
+        // Removes the part of r_dynamic's velocity that would carry it into the
+        // moving r_target during this step. r_target is left alone; resolve it
+        // against r_dynamic separately if it should be stopped too.
+        inline bool ResolveDynamicRectVsDynamicRect(olc::aabb::rect* r_dynamic, const float fTimeStep, const olc::aabb::rect* r_target)
+        {
+            olc::vf2d contact_point, contact_normal;
+            float contact_time = 0.0f;
+            if (DynamicRectVsDynamicRect(r_dynamic, fTimeStep, *r_target, contact_point, contact_normal, contact_time))
+            {
+                if (contact_normal.y > 0) r_dynamic->contact[0] = r_target;
+                if (contact_normal.x < 0) r_dynamic->contact[1] = r_target;
+                if (contact_normal.y < 0) r_dynamic->contact[2] = r_target;
+                if (contact_normal.x > 0) r_dynamic->contact[3] = r_target;
+
+                olc::vf2d rel = r_dynamic->vel - r_target->vel;
+                r_dynamic->vel += contact_normal * olc::vf2d(std::abs(rel.x), std::abs(rel.y)) * (1 - contact_time);
+                return true;
+            }
+
+            return false;
+        }
+
+        // Uniform grid over a fixed set of rects. Each cell lists the rects that
+        // overlap it, so a query only visits rects near the queried area rather
+        // than scanning the whole set. Built once; queries don't modify the grid,
+        // so it can be shared between threads. Cell (0, 0) starts at vOrigin.
+        struct grid
+        {
+            float fCellSize = 1.0f;
+            int nWidth = 0, nHeight = 0;
+            olc::vf2d vOrigin = { 0.0f, 0.0f };
+            std::vector<int> vCellStart;    // nWidth * nHeight + 1 offsets into vRectIndex
+            std::vector<int> vRectIndex;
+            std::vector<olc::vi2d> vFirstCell;  // Per rect, top-left cell it occupies
+
+            void Build(const std::vector<olc::aabb::rect>& vRects, float cell_size, int width, int height, const olc::vf2d& origin = { 0.0f, 0.0f })
+            {
+                fCellSize = cell_size; nWidth = width; nHeight = height; vOrigin = origin;
+                vCellStart.assign(size_t(nWidth * nHeight + 1), 0);
+                vRectIndex.clear();
+                vFirstCell.assign(vRects.size(), { 0, 0 });
+
+                // Count, then fill, so each cell's list is contiguous
+                auto cells = [&](const olc::aabb::rect& r, auto&& f) {
+                    int x0, y0, x1, y1;
+                    if (!CellRange(r.pos, r.pos + r.size, x0, y0, x1, y1)) return;
+                    for (int y = y0; y <= y1; y++)
+                        for (int x = x0; x <= x1; x++)
+                            f(y * nWidth + x);
+                };
+                for (auto& r : vRects)
+                    cells(r, [&](int c) { vCellStart[c + 1]++; });
+                for (size_t c = 1; c < vCellStart.size(); c++)
+                    vCellStart[c] += vCellStart[c - 1];
+                vRectIndex.resize(vCellStart.back());
+                std::vector<int> vFill(vCellStart.begin(), vCellStart.end() - 1);
+                for (size_t i = 0; i < vRects.size(); i++)
+                {
+                    int x1, y1;
+                    CellRange(vRects[i].pos, vRects[i].pos + vRects[i].size, vFirstCell[i].x, vFirstCell[i].y, x1, y1);
+                    cells(vRects[i], [&](int c) { vRectIndex[vFill[c]++] = int(i); });
+                }
+            }
+
+            // Calls f(index) once for every rect in the cells touched by the box [tl, br]
+            template<typename F>
+            void Query(const olc::vf2d& tl, const olc::vf2d& br, F&& f) const
+            {
+                int x0, y0, x1, y1;
+                if (!CellRange(tl, br, x0, y0, x1, y1)) return;
+                for (int y = y0; y <= y1; y++)
+                    for (int x = x0; x <= x1; x++)
+                        for (int c = y * nWidth + x, i = vCellStart[c]; i < vCellStart[c + 1]; i++)
+                        {
+                            // A rect spanning several cells is reported only from the
+                            // first of them that lies inside the queried range
+                            int n = vRectIndex[i];
+                            if (std::max(vFirstCell[n].x, x0) == x && std::max(vFirstCell[n].y, y0) == y)
+                                f(n);
+                        }
+            }
+
+            // Cells covered by [tl, br], inclusive of cells the edges merely touch
+            bool CellRange(const olc::vf2d& tl, const olc::vf2d& br, int& x0, int& y0, int& x1, int& y1) const
+            {
+                x0 = std::max(int(std::floor((tl.x - vOrigin.x) / fCellSize)), 0);
+                y0 = std::max(int(std::floor((tl.y - vOrigin.y) / fCellSize)), 0);
+                x1 = std::min(int(std::floor((br.x - vOrigin.x) / fCellSize)), nWidth - 1);
+                y1 = std::min(int(std::floor((br.y - vOrigin.y) / fCellSize)), nHeight - 1);
+                return x0 <= x1 && y0 <= y1;
+            }
+        };
+
+        // Structure-of-arrays copy of a set of rects, for SweepRects. Each array
+        // is 32 byte aligned and padded to a multiple of 8 entries.
+        struct rect_soa
+        {
+            float* px = nullptr;
+            float* py = nullptr;
+            float* sx = nullptr;
+            float* sy = nullptr;
+            int nCount = 0;
+
+            rect_soa() = default;
+            rect_soa(const rect_soa&) = delete;             // The array pointers point into vStore
+            rect_soa& operator=(const rect_soa&) = delete;
+
+            void Build(const std::vector<olc::aabb::rect>& vRects)
+            {
+                nCount = int(vRects.size());
+                size_t nPadded = (vRects.size() + 7) & ~size_t(7);
+                vStore.assign(nPadded * 4 + 8, 0.0f);
+                float* base = vStore.data();
+                base += (8 - (reinterpret_cast<uintptr_t>(base) / sizeof(float)) % 8) % 8;
+                px = base; py = px + nPadded; sx = py + nPadded; sy = sx + nPadded;
+                for (size_t i = 0; i < vRects.size(); i++)
+                {
+                    px[i] = vRects[i].pos.x;  py[i] = vRects[i].pos.y;
+                    sx[i] = vRects[i].size.x; sy[i] = vRects[i].size.y;
+                }
+            }
+
+            olc::aabb::rect Get(int i) const
+            {
+                return { { px[i], py[i] }, { sx[i], sy[i] } };
+            }
+
+        private:
+            std::vector<float> vStore;
+        };
+
+        enum class sweep_path { scalar, sse2, avx2 };
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define OLC_AABB_X86
+#endif
+
+        inline sweep_path DetectSweepPath()
+        {
+#if defined(OLC_AABB_X86)
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] >= 7)
+            {
+                __cpuid(info, 1);
+                bool bOSXSave = (info[2] & (1 << 27)) != 0, bAVX = (info[2] & (1 << 28)) != 0;
+                __cpuidex(info, 7, 0);
+                if (bOSXSave && bAVX && (info[1] & (1 << 5)) && (_xgetbv(0) & 6) == 6)
+                    return sweep_path::avx2;
+            }
+#else
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return sweep_path::avx2;
+#endif
+            return sweep_path::sse2;
+#else
+            return sweep_path::scalar;
+#endif
+        }
+
+        // Chosen once from the running CPU; may be overridden, e.g. to force scalar
+        inline sweep_path& SweepPath()
+        {
+            static sweep_path path = DetectSweepPath();
+            return path;
+        }
+
+        // Reference path: DynamicRectVsRect against each rect in turn
+        inline int SweepRectsScalar(const olc::aabb::rect* r_dynamic, const float fTimeStep, const rect_soa& rects,
+            const int* idx, int nBegin, int nEnd, std::pair<int, float>* hits)
+        {
+            olc::vf2d cp, cn;
+            float t = 0;
+            int nHits = 0;
+            for (int k = nBegin; k < nEnd; k++)
+            {
+                int i = idx ? idx[k] : k;
+                if (DynamicRectVsRect(r_dynamic, fTimeStep, rects.Get(i), cp, cn, t))
+                    hits[nHits++] = { i, t };
+            }
+            return nHits;
+        }
+
+#if defined(OLC_AABB_X86)
+        // The vector paths repeat RayVsRect operation for operation, with the
+        // branches turned into selects, so every lane rounds exactly like the
+        // scalar code. std::max/min and the swaps are spelled as compare+select
+        // rather than max/min instructions so signed zeros come out the same.
+#if defined(_MSC_VER)
+#define OLC_AABB_TARGET(x)
+#else
+#define OLC_AABB_TARGET(x) __attribute__((target(x)))
+#endif
+
+        OLC_AABB_TARGET("sse2")
+        inline int SweepRectsSSE2(const olc::aabb::rect* r_dynamic, const float fTimeStep, const rect_soa& rects,
+            const int* idx, int nBegin, int nEnd, std::pair<int, float>* hits)
+        {
+            if (r_dynamic->vel.x == 0 && r_dynamic->vel.y == 0)
+                return 0;
+
+            const olc::vf2d half = r_dynamic->size / 2;
+            const olc::vf2d origin = r_dynamic->pos + half;
+            const olc::vf2d dir = r_dynamic->vel * fTimeStep;
+            const olc::vf2d invdir = 1.0f / dir;
+
+            auto select = [](__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); };
+            const __m128 hx = _mm_set1_ps(half.x), hy = _mm_set1_ps(half.y);
+            const __m128 dsx = _mm_set1_ps(r_dynamic->size.x), dsy = _mm_set1_ps(r_dynamic->size.y);
+            const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y);
+            const __m128 ix = _mm_set1_ps(invdir.x), iy = _mm_set1_ps(invdir.y);
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+            int nHits = 0, k = nBegin;
+            alignas(16) float t[4];
+            for (; k + 4 <= nEnd; k += 4)
+            {
+                __m128 px, py, sx, sy;
+                if (idx)
+                {
+                    const int* i = idx + k;
+                    px = _mm_setr_ps(rects.px[i[0]], rects.px[i[1]], rects.px[i[2]], rects.px[i[3]]);
+                    py = _mm_setr_ps(rects.py[i[0]], rects.py[i[1]], rects.py[i[2]], rects.py[i[3]]);
+                    sx = _mm_setr_ps(rects.sx[i[0]], rects.sx[i[1]], rects.sx[i[2]], rects.sx[i[3]]);
+                    sy = _mm_setr_ps(rects.sy[i[0]], rects.sy[i[1]], rects.sy[i[2]], rects.sy[i[3]]);
+                }
+                else
+                {
+                    px = _mm_load_ps(rects.px + k); py = _mm_load_ps(rects.py + k);
+                    sx = _mm_load_ps(rects.sx + k); sy = _mm_load_ps(rects.sy + k);
+                }
+
+                // Expand target rectangle by source dimensions
+                __m128 ex = _mm_sub_ps(px, hx), ey = _mm_sub_ps(py, hy);
+                __m128 ew = _mm_add_ps(sx, dsx), eh = _mm_add_ps(sy, dsy);
+
+                __m128 nx = _mm_mul_ps(_mm_sub_ps(ex, ox), ix);
+                __m128 ny = _mm_mul_ps(_mm_sub_ps(ey, oy), iy);
+                __m128 fx = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(ex, ew), ox), ix);
+                __m128 fy = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(ey, eh), oy), iy);
+
+                __m128 ok = _mm_and_ps(_mm_cmpord_ps(nx, ny), _mm_cmpord_ps(fx, fy));
+
+                __m128 swx = _mm_cmpgt_ps(nx, fx), swy = _mm_cmpgt_ps(ny, fy);
+                __m128 nx2 = select(swx, fx, nx), fx2 = select(swx, nx, fx);
+                __m128 ny2 = select(swy, fy, ny), fy2 = select(swy, ny, fy);
+
+                ok = _mm_andnot_ps(_mm_or_ps(_mm_cmpgt_ps(nx2, fy2), _mm_cmpgt_ps(ny2, fx2)), ok);
+
+                __m128 tnear = select(_mm_cmplt_ps(nx2, ny2), ny2, nx2);
+                __m128 tfar = select(_mm_cmplt_ps(fy2, fx2), fy2, fx2);
+                ok = _mm_andnot_ps(_mm_cmplt_ps(tfar, zero), ok);
+                ok = _mm_and_ps(ok, _mm_and_ps(_mm_cmpge_ps(tnear, zero), _mm_cmplt_ps(tnear, one)));
+
+                int mask = _mm_movemask_ps(ok);
+                if (mask)
+                {
+                    _mm_store_ps(t, tnear);
+                    for (int l = 0; l < 4; l++)
+                        if (mask & (1 << l))
+                            hits[nHits++] = { idx ? idx[k + l] : k + l, t[l] };
+                }
+            }
+
+            return nHits + SweepRectsScalar(r_dynamic, fTimeStep, rects, idx, k, nEnd, hits + nHits);
+        }
+
+        OLC_AABB_TARGET("avx2")
+        inline int SweepRectsAVX2(const olc::aabb::rect* r_dynamic, const float fTimeStep, const rect_soa& rects,
+            const int* idx, int nBegin, int nEnd, std::pair<int, float>* hits)
+        {
+            if (r_dynamic->vel.x == 0 && r_dynamic->vel.y == 0)
+                return 0;
+
+            const olc::vf2d half = r_dynamic->size / 2;
+            const olc::vf2d origin = r_dynamic->pos + half;
+            const olc::vf2d dir = r_dynamic->vel * fTimeStep;
+            const olc::vf2d invdir = 1.0f / dir;
+
+            const __m256 hx = _mm256_set1_ps(half.x), hy = _mm256_set1_ps(half.y);
+            const __m256 dsx = _mm256_set1_ps(r_dynamic->size.x), dsy = _mm256_set1_ps(r_dynamic->size.y);
+            const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y);
+            const __m256 ix = _mm256_set1_ps(invdir.x), iy = _mm256_set1_ps(invdir.y);
+            const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+
+            int nHits = 0, k = nBegin;
+            alignas(32) float t[8];
+            for (; k + 8 <= nEnd; k += 8)
+            {
+                __m256 px, py, sx, sy;
+                if (idx)
+                {
+                    __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + k));
+                    px = _mm256_i32gather_ps(rects.px, i, 4); py = _mm256_i32gather_ps(rects.py, i, 4);
+                    sx = _mm256_i32gather_ps(rects.sx, i, 4); sy = _mm256_i32gather_ps(rects.sy, i, 4);
+                }
+                else
+                {
+                    px = _mm256_load_ps(rects.px + k); py = _mm256_load_ps(rects.py + k);
+                    sx = _mm256_load_ps(rects.sx + k); sy = _mm256_load_ps(rects.sy + k);
+                }
+
+                // Expand target rectangle by source dimensions
+                __m256 ex = _mm256_sub_ps(px, hx), ey = _mm256_sub_ps(py, hy);
+                __m256 ew = _mm256_add_ps(sx, dsx), eh = _mm256_add_ps(sy, dsy);
+
+                __m256 nx = _mm256_mul_ps(_mm256_sub_ps(ex, ox), ix);
+                __m256 ny = _mm256_mul_ps(_mm256_sub_ps(ey, oy), iy);
+                __m256 fx = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(ex, ew), ox), ix);
+                __m256 fy = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(ey, eh), oy), iy);
+
+                __m256 ok = _mm256_and_ps(_mm256_cmp_ps(nx, ny, _CMP_ORD_Q), _mm256_cmp_ps(fx, fy, _CMP_ORD_Q));
+
+                __m256 swx = _mm256_cmp_ps(nx, fx, _CMP_GT_OQ), swy = _mm256_cmp_ps(ny, fy, _CMP_GT_OQ);
+                __m256 nx2 = _mm256_blendv_ps(nx, fx, swx), fx2 = _mm256_blendv_ps(fx, nx, swx);
+                __m256 ny2 = _mm256_blendv_ps(ny, fy, swy), fy2 = _mm256_blendv_ps(fy, ny, swy);
+
+                ok = _mm256_andnot_ps(_mm256_or_ps(_mm256_cmp_ps(nx2, fy2, _CMP_GT_OQ), _mm256_cmp_ps(ny2, fx2, _CMP_GT_OQ)), ok);
+
+                __m256 tnear = _mm256_blendv_ps(nx2, ny2, _mm256_cmp_ps(nx2, ny2, _CMP_LT_OQ));
+                __m256 tfar = _mm256_blendv_ps(fx2, fy2, _mm256_cmp_ps(fy2, fx2, _CMP_LT_OQ));
+                ok = _mm256_andnot_ps(_mm256_cmp_ps(tfar, zero, _CMP_LT_OQ), ok);
+                ok = _mm256_and_ps(ok, _mm256_and_ps(_mm256_cmp_ps(tnear, zero, _CMP_GE_OQ), _mm256_cmp_ps(tnear, one, _CMP_LT_OQ)));
+
+                int mask = _mm256_movemask_ps(ok);
+                if (mask)
+                {
+                    _mm256_store_ps(t, tnear);
+                    for (int l = 0; l < 8; l++)
+                        if (mask & (1 << l))
+                            hits[nHits++] = { idx ? idx[k + l] : k + l, t[l] };
+                }
+            }
+
+            return nHits + SweepRectsSSE2(r_dynamic, fTimeStep, rects, idx, k, nEnd, hits + nHits);
+        }
+#endif
+
+        // Sweeps r_dynamic against rects idx[0..nIdx) of the store (or the first
+        // nIdx rects when idx is null) and writes one {index, contact time} per
+        // hit to hits, in input order. hits must have room for nIdx entries.
+        inline int SweepRects(const olc::aabb::rect* r_dynamic, const float fTimeStep, const rect_soa& rects,
+            const int* idx, int nIdx, std::pair<int, float>* hits)
+        {
+            int nHits = 0;
+            switch (SweepPath())
+            {
+#if defined(OLC_AABB_X86)
+            case sweep_path::avx2: nHits = SweepRectsAVX2(r_dynamic, fTimeStep, rects, idx, 0, nIdx, hits); break;
+            case sweep_path::sse2: nHits = SweepRectsSSE2(r_dynamic, fTimeStep, rects, idx, 0, nIdx, hits); break;
+#endif
+            default: nHits = SweepRectsScalar(r_dynamic, fTimeStep, rects, idx, 0, nIdx, hits); break;
+            }
+
+#if defined(_DEBUG)
+            // Debug builds hold every vector result to the scalar reference, bit for bit
+            olc::vf2d cp, cn;
+            float t = 0;
+            int nRef = 0;
+            for (int k = 0; k < nIdx; k++)
+            {
+                int i = idx ? idx[k] : k;
+                if (DynamicRectVsRect(r_dynamic, fTimeStep, rects.Get(i), cp, cn, t))
+                {
+                    assert(nRef < nHits && hits[nRef].first == i && std::memcmp(&hits[nRef].second, &t, sizeof(float)) == 0);
+                    nRef++;
+                }
+            }
+            assert(nRef == nHits);
+#endif
+            return nHits;
+        }
+    }
+}
@@ -79,6 +79,16 @@
 #undef min
 #undef max
 
+// Audio thread tracing hooks. Define OLC_SOUND_TRACE_BEGIN(name),
+// OLC_SOUND_TRACE_END(name) and OLC_SOUND_TRACE_INSTANT(name) before including
+// to mark block waits, mixing, submission and underruns; name is a string
+// literal. They compile to nothing otherwise
+#if !defined(OLC_SOUND_TRACE_BEGIN)
+#define OLC_SOUND_TRACE_BEGIN(name)
+#define OLC_SOUND_TRACE_END(name)
+#define OLC_SOUND_TRACE_INSTANT(name)
+#endif
+
 // Choose a default sound backend
 #if !defined(USE_ALSA) && !defined(USE_OPENAL) && !defined(USE_WINDOWS)
 #ifdef __linux__
@@ -530,12 +540,20 @@ namespace olc
 		while (m_bAudioThreadActive)
 		{
 			// Wait for block to become available
+			OLC_SOUND_TRACE_BEGIN("audio_wait");
 			if (m_nBlockFree == 0)
 			{
 				std::unique_lock<std::mutex> lm(m_muxBlockNotZero);
 				while (m_nBlockFree == 0) // sometimes, Windows signals incorrectly
 					m_cvBlockNotZero.wait(lm);
 			}
+			OLC_SOUND_TRACE_END("audio_wait");
+
+			// Every block free means the device has played out everything queued
+			if (m_nBlockFree == m_nBlockCount)
+			{
+				OLC_SOUND_TRACE_INSTANT("audio_underrun");
+			}
 
 			// Block is here, so use it
 			m_nBlockFree--;
@@ -562,6 +580,7 @@ namespace olc
 			// Our time per frame coefficient
 			float fElapsedTime = elapsedTime.count();
 
+			OLC_SOUND_TRACE_BEGIN("audio_mix");
 			for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
 			{
 				// User Process
@@ -572,12 +591,15 @@ namespace olc
 					nPreviousSample = nNewSample;
 				}				
 			}
+			OLC_SOUND_TRACE_END("audio_mix");
 
 			m_fGlobalTime = m_fGlobalTime + fTimeStep * (float)m_nBlockSamples;
 
 			// Send block to sound device
+			OLC_SOUND_TRACE_BEGIN("audio_submit");
 			waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
 			waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+			OLC_SOUND_TRACE_END("audio_submit");
 			m_nBlockCurrent++;
 			m_nBlockCurrent %= m_nBlockCount;
 		}
@@ -691,6 +713,7 @@ namespace olc
 					return fmax(fSample, -fMax);
 			};
 
+			OLC_SOUND_TRACE_BEGIN("audio_mix");
 			for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
 			{
 				// User Process
@@ -701,10 +724,12 @@ namespace olc
 					nPreviousSample = nNewSample;
 				}		
 			}
+			OLC_SOUND_TRACE_END("audio_mix");
 
 			m_fGlobalTime = m_fGlobalTime + fTimeStep * (float)m_nBlockSamples;
 
 			// Send block to sound device
+			OLC_SOUND_TRACE_BEGIN("audio_submit");
 			snd_pcm_uframes_t nLeft = m_nBlockSamples;
 			short *pBlockPos = m_pBlockMemory;
 			while (nLeft > 0)
@@ -717,8 +742,12 @@ namespace olc
 				}
 				if (rc == -EAGAIN) continue;
 				if (rc == -EPIPE) // an underrun occured, prepare the device for more data
+				{
+					OLC_SOUND_TRACE_INSTANT("audio_underrun");
 					snd_pcm_prepare(m_pPCM);
+				}
 			}
+			OLC_SOUND_TRACE_END("audio_submit");
 		}
 	}
 
@@ -833,6 +862,7 @@ namespace olc
 					return fmax(fSample, -fMax);
 			};
 
+			OLC_SOUND_TRACE_BEGIN("audio_mix");
 			for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
 			{
 				// User Process
@@ -845,8 +875,10 @@ namespace olc
 
 				m_fGlobalTime = m_fGlobalTime + fTimeStep;
 			}
+			OLC_SOUND_TRACE_END("audio_mix");
 
 			// Fill OpenAL data buffer
+			OLC_SOUND_TRACE_BEGIN("audio_submit");
 			alBufferData(
 				m_qAvailableBuffers.front(),
 				m_nChannels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
@@ -859,9 +891,15 @@ namespace olc
 			// Remove it from ours
 			m_qAvailableBuffers.pop();
 
-			// If it's not playing for some reason, change that
+			OLC_SOUND_TRACE_END("audio_submit");
+
+			// If it's not playing for some reason, change that; the source
+			// stops when it runs out of queued buffers
 			if (nState != AL_PLAYING)
+			{
+				OLC_SOUND_TRACE_INSTANT("audio_underrun");
 				alSourcePlay(m_nSource);
+			}
 		}
 	}
 
@@ -323,6 +323,14 @@ namespace _gfs = std::filesystem;
 
 #define UNUSED(x) (void)(x)
 
+// Frame stage hooks. Define OLC_PROFILE_BEGIN(stage) and OLC_PROFILE_END(stage)
+// before including to time the INPUT, DECALS, UPLOAD, DISPLAY and FRAME stages
+// of olc_CoreUpdate; they compile to nothing otherwise
+#if !defined(OLC_PROFILE_BEGIN)
+#define OLC_PROFILE_BEGIN(stage)
+#define OLC_PROFILE_END(stage)
+#endif
+
 // O------------------------------------------------------------------------------O
 // | PLATFORM SELECTION CODE, Thanks slavka!                                      |
 // O------------------------------------------------------------------------------O
@@ -523,7 +531,7 @@ namespace olc
 		T y = 0;
 		v2d_generic() : x(0), y(0) {}
 		v2d_generic(T _x, T _y) : x(_x), y(_y) {}
-		v2d_generic(const v2d_generic& v) : x(v.x), y(v.y) {}
+		v2d_generic(const v2d_generic& v) = default;
 		v2d_generic& operator=(const v2d_generic& v) = default;
 		T mag() const { return T(std::sqrt(x * x + y * y)); }
 		T mag2() const { return x * x + y * y; }
@@ -3012,6 +3020,8 @@ namespace olc
 
 	void PixelGameEngine::olc_CoreUpdate()
 	{
+		OLC_PROFILE_BEGIN(FRAME);
+
 		// Handle Timing
 		m_tp2 = std::chrono::system_clock::now();
 		std::chrono::duration<float> elapsedTime = m_tp2 - m_tp1;
@@ -3048,8 +3058,10 @@ namespace olc
 			}
 		};
 
+		OLC_PROFILE_BEGIN(INPUT);
 		ScanHardware(pKeyboardState, pKeyOldState, pKeyNewState, 256);
 		ScanHardware(pMouseState, pMouseOldState, pMouseNewState, nMouseButtons);
+		OLC_PROFILE_END(INPUT);
 
 		// Cache mouse coordinates so they remain consistent during frame
 		vMousePos = vMousePosCache;
@@ -3082,16 +3094,20 @@ namespace olc
 					renderer->ApplyTexture(layer->nResID);
 					if (layer->bUpdate)
 					{
+						OLC_PROFILE_BEGIN(UPLOAD);
 						renderer->UpdateTexture(layer->nResID, layer->pDrawTarget);
+						OLC_PROFILE_END(UPLOAD);
 						layer->bUpdate = false;
 					}
 
 					renderer->DrawLayerQuad(layer->vOffset, layer->vScale, layer->tint);
 
 					// Display Decals in order for this layer
+					OLC_PROFILE_BEGIN(DECALS);
 					for (auto& decal : layer->vecDecalInstance)
 						renderer->DrawDecal(decal);
 					layer->vecDecalInstance.clear();
+					OLC_PROFILE_END(DECALS);
 				}
 				else
 				{
@@ -3102,7 +3118,9 @@ namespace olc
 		}
 
 		// Present Graphics to screen
+		OLC_PROFILE_BEGIN(DISPLAY);
 		renderer->DisplayFrame();
+		OLC_PROFILE_END(DISPLAY);
 
 		// Update Title Bar
 		fFrameTimer += fElapsedTime;
@@ -3115,6 +3133,8 @@ namespace olc
 			platform->SetWindowTitle(sTitle);
 			nFrameCount = 0;
 		}
+
+		OLC_PROFILE_END(FRAME);
 	}
 
 	void PixelGameEngine::olc_ConstructFontSheet()
@@ -65,10 +65,10 @@ goto :error
 echo %CPP%
 	if exist "./assets" (
 		echo Starting Build with assets...
-		call em++ -std=c++17 -O1 -s ALLOW_MEMORY_GROWTH=1 -s MAX_WEBGL_VERSION=2 -s MIN_WEBGL_VERSION=2 -s USE_LIBPNG=1 "%CPP%" -o .\WASM\pge.html -I %OLCPGE% --preload-file ./assets
+		call em++ -std=c++17 -O1 -ffp-contract=off -s ALLOW_MEMORY_GROWTH=1 -s MAX_WEBGL_VERSION=2 -s MIN_WEBGL_VERSION=2 -s USE_LIBPNG=1 "%CPP%" -o .\WASM\pge.html -I %OLCPGE% --preload-file ./assets
 	) else (
 		echo Starting Build without assets...
-		call em++ -std=c++17 -O1 -s ALLOW_MEMORY_GROWTH=1 -s MAX_WEBGL_VERSION=2 -s MIN_WEBGL_VERSION=2 -s USE_LIBPNG=1 "%CPP%" -o .\WASM\pge.html -I %OLCPGE%
+		call em++ -std=c++17 -O1 -ffp-contract=off -s ALLOW_MEMORY_GROWTH=1 -s MAX_WEBGL_VERSION=2 -s MIN_WEBGL_VERSION=2 -s USE_LIBPNG=1 "%CPP%" -o .\WASM\pge.html -I %OLCPGE%
 	)
 	
 	echo Build Completed